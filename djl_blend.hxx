@@ -0,0 +1,336 @@
+#pragma once
+
+//
+// Per-frame kernels for slideshow transitions over 32bpp BGRX frame buffers:
+//     BlendFrames:   dst = a + ( b - a ) * alpha / 256, i.e. one step of a crossfade
+//     SampleAffine:  dst( x, y ) = src( M * ( x, y ) ) with bilinear filtering, i.e. sub-pixel pan and zoom
+// The frame is split into bands of rows run across all cores, and each row uses SSE2 or NEON when available.
+// A 4K frame is 33MB, so blending is memory bound; the SIMD keeps the arithmetic well below the memory traffic.
+// Usage:
+//      CBlend::BlendFrames( back, from, to, alpha );
+//      CBlend::SampleAffine( back, to, CBlend::ZoomAbout( to.Width(), to.Height(), 1.05, 0.3, 0.7 ) );
+//
+
+#include <stdint.h>
+#include <math.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <djl_os.hxx>
+#include <djl_fb.hxx>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+    #include <emmintrin.h>
+    #define DJL_BLEND_SSE2
+#elif defined( _M_ARM64 ) || defined( __aarch64__ )
+    #include <arm_neon.h>
+    #define DJL_BLEND_NEON
+#endif
+
+#ifdef _WIN32
+    #include <ppl.h>
+#endif
+
+using namespace std;
+
+class CBlend
+{
+    public:
+        // dst = src( u, v ) where u = xx * x + xy * y + x0 and v = yx * x + yy * y + y0, in pixel units
+
+        struct Affine
+        {
+            double xx, xy, x0;
+            double yx, yy, y0;
+        };
+
+        // Blend two BGRX pixels, two channels per multiply, rounding to nearest. w is 0..256.
+
+        static inline uint32_t Lerp( uint32_t a, uint32_t b, uint32_t w )
+        {
+            uint32_t iw = 256 - w;
+            uint32_t rb = ( ( ( a & 0xff00ff ) * iw + ( b & 0xff00ff ) * w + 0x800080 ) >> 8 ) & 0xff00ff;
+            uint32_t gx = ( ( ( a >> 8 ) & 0xff00ff ) * iw + ( ( b >> 8 ) & 0xff00ff ) * w + 0x800080 ) & 0xff00ff00;
+            return rb | gx;
+        } //Lerp
+
+    private:
+        static const int RowsPerBand = 32; // enough work per task to amortize scheduling, small enough to balance
+
+        template <typename T> static void ParallelRows( int rows, const T & rowBand )
+        {
+            int bands = ( rows + RowsPerBand - 1 ) / RowsPerBand;
+
+#ifdef _WIN32
+            concurrency::parallel_for( 0, bands, [&] ( int b )
+            {
+                rowBand( b * RowsPerBand, get_min( rows, ( b + 1 ) * RowsPerBand ) );
+            } );
+#else
+            int threads = get_min( bands, (int) get_max( 1u, std::thread::hardware_concurrency() ) );
+            std::atomic<int> next( 0 );
+
+            auto worker = [&] ()
+            {
+                for ( int b = next++; b < bands; b = next++ )
+                    rowBand( b * RowsPerBand, get_min( rows, ( b + 1 ) * RowsPerBand ) );
+            };
+
+            vector<std::thread> pool;
+            for ( int t = 1; t < threads; t++ )
+                pool.emplace_back( worker );
+
+            worker();
+
+            for ( size_t t = 0; t < pool.size(); t++ )
+                pool[ t ].join();
+#endif
+        } //ParallelRows
+
+        static void BlendRow( uint32_t * d, const uint32_t * a, const uint32_t * b, int n, uint32_t alpha )
+        {
+            int i = 0;
+
+#if defined( DJL_BLEND_SSE2 )
+            // The weighted sum is at most 255 * 256 plus the rounding bias, so it fits in an unsigned 16-bit lane
+
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i half = _mm_set1_epi16( 128 );
+            const __m128i wa = _mm_set1_epi16( (short) ( 256 - alpha ) );
+            const __m128i wb = _mm_set1_epi16( (short) alpha );
+
+            for ( ; i + 4 <= n; i += 4 )
+            {
+                __m128i va = _mm_loadu_si128( (const __m128i *) ( a + i ) );
+                __m128i vb = _mm_loadu_si128( (const __m128i *) ( b + i ) );
+
+                __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( va, zero ), wa ),
+                                            _mm_mullo_epi16( _mm_unpacklo_epi8( vb, zero ), wb ) );
+                __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( va, zero ), wa ),
+                                            _mm_mullo_epi16( _mm_unpackhi_epi8( vb, zero ), wb ) );
+
+                lo = _mm_srli_epi16( _mm_add_epi16( lo, half ), 8 );
+                hi = _mm_srli_epi16( _mm_add_epi16( hi, half ), 8 );
+                _mm_storeu_si128( (__m128i *) ( d + i ), _mm_packus_epi16( lo, hi ) );
+            }
+#elif defined( DJL_BLEND_NEON )
+            const uint16x8_t wa = vdupq_n_u16( (uint16_t) ( 256 - alpha ) );
+            const uint16x8_t wb = vdupq_n_u16( (uint16_t) alpha );
+
+            for ( ; i + 4 <= n; i += 4 )
+            {
+                uint8x16_t va = vld1q_u8( (const uint8_t *) ( a + i ) );
+                uint8x16_t vb = vld1q_u8( (const uint8_t *) ( b + i ) );
+
+                uint16x8_t lo = vmlaq_u16( vmulq_u16( vmovl_u8( vget_low_u8( va ) ), wa ), vmovl_u8( vget_low_u8( vb ) ), wb );
+                uint16x8_t hi = vmlaq_u16( vmulq_u16( vmovl_u8( vget_high_u8( va ) ), wa ), vmovl_u8( vget_high_u8( vb ) ), wb );
+
+                vst1q_u8( (uint8_t *) ( d + i ), vcombine_u8( vrshrn_n_u16( lo, 8 ), vrshrn_n_u16( hi, 8 ) ) );
+            }
+#endif
+
+            for ( ; i < n; i++ )
+                d[ i ] = Lerp( a[ i ], b[ i ], alpha );
+        } //BlendRow
+
+        static inline uint32_t Bilinear( const CFrameBuffer & src, int64_t u, int64_t v )
+        {
+            // u and v are 32.32 fixed point with pixel centers at integers; clamp so all 4 taps are inside
+
+            int maxX = src.Width() - 1;
+            int maxY = src.Height() - 1;
+            int ui = (int) ( u >> 32 );
+            int vi = (int) ( v >> 32 );
+            uint32_t fx = (uint32_t) ( ( u >> 24 ) & 0xff );
+            uint32_t fy = (uint32_t) ( ( v >> 24 ) & 0xff );
+
+            if ( ui < 0 ) { ui = 0; fx = 0; }
+            if ( vi < 0 ) { vi = 0; fy = 0; }
+            if ( ui >= maxX ) { ui = get_max( 0, maxX - 1 ); fx = ( maxX > 0 ) ? 256 : 0; }
+            if ( vi >= maxY ) { vi = get_max( 0, maxY - 1 ); fy = ( maxY > 0 ) ? 256 : 0; }
+
+            const uint32_t * p0 = src.Row( vi ) + ui;
+            const uint32_t * p1 = ( maxY > 0 ) ? p0 + src.Stride() : p0;
+            int dx = ( maxX > 0 ) ? 1 : 0;
+
+#if defined( DJL_BLEND_SSE2 )
+            if ( 0 == dx ) // 1-pixel-wide source; the 2-pixel loads below would read past the row
+                return Lerp( p0[ 0 ], p1[ 0 ], fy );
+
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i half = _mm_set1_epi16( 128 );
+            __m128i top = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *) p0 ), zero );  // p00 | p01 as 16-bit lanes
+            __m128i bot = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *) p1 ), zero );  // p10 | p11
+
+            __m128i wy0 = _mm_set1_epi16( (short) ( 256 - fy ) );
+            __m128i wy1 = _mm_set1_epi16( (short) fy );
+            __m128i col = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( top, wy0 ), _mm_mullo_epi16( bot, wy1 ) ), half );
+            col = _mm_srli_epi16( col, 8 );
+
+            __m128i wx = _mm_set_epi16( (short) fx, (short) fx, (short) fx, (short) fx,
+                                        (short) ( 256 - fx ), (short) ( 256 - fx ), (short) ( 256 - fx ), (short) ( 256 - fx ) );
+            __m128i prod = _mm_mullo_epi16( col, wx );
+            __m128i sum = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( prod, _mm_unpackhi_epi64( prod, prod ) ), half ), 8 );
+            return (uint32_t) _mm_cvtsi128_si32( _mm_packus_epi16( sum, sum ) );
+#else
+            return Lerp( Lerp( p0[ 0 ], p0[ dx ], fx ), Lerp( p1[ 0 ], p1[ dx ], fx ), fy );
+#endif
+        } //Bilinear
+
+        static void SampleRow( uint32_t * d, int n, int y, const CFrameBuffer & src, const Affine & m, vector<uint32_t> & scratch )
+        {
+            // Sample at pixel centers: map ( x + 0.5, y + 0.5 ) then shift back by half a source pixel
+
+            double cy = y + 0.5;
+            double u = m.xx * 0.5 + m.xy * cy + m.x0 - 0.5;
+            double v = m.yx * 0.5 + m.yy * cy + m.y0 - 0.5;
+
+            // 32 fraction bits so stepping across an 8K row accumulates well under 1/256 of a pixel of error
+
+            const double one = 4294967296.0;
+            int64_t uf = (int64_t) llround( u * one );
+            int64_t vf = (int64_t) llround( v * one );
+            int64_t du = (int64_t) llround( m.xx * one );
+            int64_t dv = (int64_t) llround( m.yx * one );
+
+            if ( 0 != dv || src.Width() < 2 )
+            {
+                // rotation or shear: every pixel has its own vertical weight
+
+                for ( int x = 0; x < n; x++ )
+                {
+                    d[ x ] = Bilinear( src, uf, vf );
+                    uf += du;
+                    vf += dv;
+                }
+
+                return;
+            }
+
+            // Pan and zoom: the whole row shares one pair of source rows and one vertical weight.
+            // Blend those rows once with the SIMD row kernel, then only the horizontal lerp is per pixel.
+
+            int maxX = src.Width() - 1;
+            int maxY = src.Height() - 1;
+            int vi = (int) ( vf >> 32 );
+            uint32_t fy = (uint32_t) ( ( vf >> 24 ) & 0xff );
+
+            if ( vi < 0 ) { vi = 0; fy = 0; }
+            if ( vi >= maxY ) { vi = get_max( 0, maxY - 1 ); fy = ( maxY > 0 ) ? 256 : 0; }
+
+            // Columns the row's taps can touch. Taps left or right of the source clamp to columns 0..1 or
+            // maxX-1..maxX, so those are always included, even when the whole row lands outside the source.
+
+            int64_t uLast = uf + du * ( n - 1 );
+            int first = (int) get_min( (int64_t) maxX - 1, get_max( (int64_t) 0, get_min( uf, uLast ) >> 32 ) );
+            int last = (int) get_max( (int64_t) 1, get_min( (int64_t) maxX, ( get_max( uf, uLast ) >> 32 ) + 1 ) );
+
+            scratch.resize( src.Width() );
+            uint32_t * col = scratch.data();
+            const uint32_t * r0 = src.Row( vi );
+            const uint32_t * r1 = ( maxY > 0 ) ? src.Row( vi + 1 ) : r0;
+
+            BlendRow( col + first, r0 + first, r1 + first, last - first + 1, fy );
+
+            int x = 0;
+
+#if defined( DJL_BLEND_SSE2 )
+            // Two output pixels per step while both taps of both pixels are inside the row
+
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i half = _mm_set1_epi16( 128 );
+            const __m128i w256 = _mm_set1_epi16( 256 );
+            const int64_t limit = (int64_t) maxX << 32;
+
+            for ( ; x + 2 <= n; x += 2 )
+            {
+                int64_t u1 = uf + du;
+                if ( uf < 0 || u1 < 0 || uf >= limit || u1 >= limit )
+                    break;
+
+                int ui0 = (int) ( uf >> 32 );
+                int ui1 = (int) ( u1 >> 32 );
+                __m128i f0 = _mm_set1_epi16( (short) ( ( uf >> 24 ) & 0xff ) );
+                __m128i f1 = _mm_set1_epi16( (short) ( ( u1 >> 24 ) & 0xff ) );
+                __m128i w0 = _mm_unpacklo_epi64( _mm_sub_epi16( w256, f0 ), f0 );   // 256-f x 4 | f x 4
+                __m128i w1 = _mm_unpacklo_epi64( _mm_sub_epi16( w256, f1 ), f1 );
+
+                __m128i p0 = _mm_mullo_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *) ( col + ui0 ) ), zero ), w0 );
+                __m128i p1 = _mm_mullo_epi16( _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *) ( col + ui1 ) ), zero ), w1 );
+                __m128i sum = _mm_add_epi16( _mm_add_epi16( _mm_unpacklo_epi64( p0, p1 ), _mm_unpackhi_epi64( p0, p1 ) ), half );
+                sum = _mm_srli_epi16( sum, 8 );
+                _mm_storel_epi64( (__m128i *) ( d + x ), _mm_packus_epi16( sum, sum ) );
+
+                uf = u1 + du;
+            }
+#endif
+
+            for ( ; x < n; x++ )
+            {
+                int ui = (int) ( uf >> 32 );
+                uint32_t fx = (uint32_t) ( ( uf >> 24 ) & 0xff );
+
+                if ( ui < 0 ) { ui = 0; fx = 0; }
+                if ( ui >= maxX ) { ui = maxX - 1; fx = 256; }
+
+                d[ x ] = Lerp( col[ ui ], col[ ui + 1 ], fx );
+                uf += du;
+            }
+        } //SampleRow
+
+    public:
+        // alpha is 0 (all a) through 256 (all b). dst may be the same buffer as a or b.
+
+        static void BlendFrames( CFrameBuffer & dst, const CFrameBuffer & a, const CFrameBuffer & b, uint32_t alpha )
+        {
+            if ( alpha > 256 )
+                alpha = 256;
+
+            int w = get_min( dst.Width(), get_min( a.Width(), b.Width() ) );
+            int h = get_min( dst.Height(), get_min( a.Height(), b.Height() ) );
+
+            ParallelRows( h, [&] ( int yStart, int yEnd )
+            {
+                for ( int y = yStart; y < yEnd; y++ )
+                    BlendRow( dst.Row( y ), a.Row( y ), b.Row( y ), w, alpha );
+            } );
+        } //BlendFrames
+
+        // dst must not be src
+
+        static void SampleAffine( CFrameBuffer & dst, const CFrameBuffer & src, const Affine & m )
+        {
+            if ( !src.Ok() || !dst.Ok() )
+                return;
+
+            ParallelRows( dst.Height(), [&] ( int yStart, int yEnd )
+            {
+                vector<uint32_t> scratch;
+
+                for ( int y = yStart; y < yEnd; y++ )
+                    SampleRow( dst.Row( y ), dst.Width(), y, src, m, scratch );
+            } );
+        } //SampleAffine
+
+        // Map a w x h destination onto a w x h source magnified by zoom (>= 1). focusX and focusY (0..1)
+        // pick which part of the source stays in view, so the window never leaves the source.
+
+        static Affine ZoomAbout( int w, int h, double zoom, double focusX, double focusY )
+        {
+            if ( zoom < 1.0 )
+                zoom = 1.0;
+
+            double s = 1.0 / zoom;
+            Affine m;
+            m.xx = s;
+            m.xy = 0.0;
+            m.x0 = focusX * w * ( 1.0 - s );
+            m.yx = 0.0;
+            m.yy = s;
+            m.y0 = focusY * h * ( 1.0 - s );
+            return m;
+        } //ZoomAbout
+}; //CBlend
+
@@ -0,0 +1,301 @@
+#pragma once
+
+//
+// Size-classed pool of large, page-aligned buffers, e.g. for decoded frames.
+// A slideshow decodes one screen-sized image after another, so the buffer released for the previous
+// frame is almost always the right size for the next one. Recycling it avoids the large allocation,
+// the page faults to commit it, and the zeroing the OS does for fresh pages.
+// Optionally backed by large pages on Windows (requires SeLockMemoryPrivilege) or huge pages on Linux.
+// Usage:
+//      CBufferPool pool;
+//      uint8_t * p = pool.Allocate( cb );
+//      ...
+//      pool.Free( p );
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mutex>
+#include <map>
+#include <vector>
+#include <unordered_map>
+
+#include <djl_os.hxx>
+#include <djltrace.hxx>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <errno.h>
+#endif
+
+using namespace std;
+
+class CBufferPool
+{
+    private:
+        std::mutex mtx;
+        map<size_t, vector<uint8_t *>> freeLists;    // size class => buffers ready for reuse
+        unordered_map<uint8_t *, size_t> sizes;      // every buffer owned by the pool => its size class
+        size_t pageSize;                              // allocation granularity; the large page size when using them
+        size_t smallPageSize;
+        size_t cachedBytes;
+        size_t maxCachedBytes;
+        bool largePages;
+        size_t osAllocations;
+        size_t reuses;
+
+        static size_t SmallPageSize()
+        {
+#ifdef _WIN32
+            SYSTEM_INFO si;
+            GetSystemInfo( &si );
+            return si.dwPageSize;
+#else
+            long ps = sysconf( _SC_PAGESIZE );
+            return ( ps > 0 ) ? (size_t) ps : 4096;
+#endif
+        } //SmallPageSize
+
+        static size_t LargePageSize()
+        {
+#ifdef _WIN32
+            return GetLargePageMinimum();
+#else
+            return 2 * 1024 * 1024; // the common x64 and arm64 default
+#endif
+        } //LargePageSize
+
+#ifdef _WIN32
+        static bool EnableLockMemoryPrivilege()
+        {
+            // Large pages can't be paged out, so Windows only hands them to processes holding SeLockMemoryPrivilege.
+
+            HANDLE hToken = 0;
+            if ( !OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken ) )
+                return false;
+
+            TOKEN_PRIVILEGES tp = {};
+            tp.PrivilegeCount = 1;
+            tp.Privileges[ 0 ].Attributes = SE_PRIVILEGE_ENABLED;
+            bool ok = LookupPrivilegeValue( NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[ 0 ].Luid ) &&
+                      AdjustTokenPrivileges( hToken, FALSE, &tp, 0, NULL, 0 ) &&
+                      ( ERROR_SUCCESS == GetLastError() ); // AdjustTokenPrivileges "succeeds" when it assigns nothing
+
+            CloseHandle( hToken );
+            return ok;
+        } //EnableLockMemoryPrivilege
+#endif
+
+        size_t SizeClass( size_t cb )
+        {
+            // Round up to whole pages, then to one of 4 steps per power of two so a slightly
+            // different image size still lands in the class of the buffer just released.
+            // Worst-case waste is 25%.
+
+            size_t pages = ( cb + pageSize - 1 ) / pageSize;
+            if ( 0 == pages )
+                pages = 1;
+
+            size_t pow2 = 1;
+            while ( ( pow2 << 1 ) <= pages )
+                pow2 <<= 1;
+
+            size_t step = get_max( (size_t) 1, pow2 / 4 );
+            return round_up( pages, step ) * pageSize;
+        } //SizeClass
+
+        uint8_t * OSAllocate( size_t cb )
+        {
+            void * p = NULL;
+
+#ifdef _WIN32
+            if ( largePages )
+            {
+                p = VirtualAlloc( NULL, cb, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+                if ( NULL == p )
+                {
+                    // physical memory is too fragmented or the privilege was revoked; don't keep paying to find out
+
+                    tracer.Trace( "large page allocation of %zu bytes failed, error %d\n", cb, GetLastError() );
+                    largePages = false;
+                    pageSize = smallPageSize;
+                }
+            }
+
+            if ( NULL == p )
+            {
+                p = VirtualAlloc( NULL, cb, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+
+                // Touch each page now so the decoder doesn't take the demand-zero faults while it writes.
+                // Large pages are already resident.
+
+                if ( NULL != p )
+                    for ( size_t o = 0; o < cb; o += smallPageSize )
+                        ( (volatile uint8_t *) p )[ o ] = 0;
+            }
+#else
+            if ( largePages )
+            {
+                p = mmap( NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0 );
+                if ( MAP_FAILED == p )
+                {
+                    tracer.Trace( "huge page allocation of %zu bytes failed, errno %d\n", cb, errno );
+                    largePages = false;
+                    pageSize = smallPageSize;
+                    p = NULL;
+                }
+            }
+
+            if ( NULL == p )
+            {
+                p = mmap( NULL, cb, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+                if ( MAP_FAILED == p )
+                    p = NULL;
+                else
+                {
+                    // transparent huge pages are a hint; populate after so the prefault uses them when possible
+
+                    madvise( p, cb, MADV_HUGEPAGE );
+                    madvise( p, cb, MADV_WILLNEED );
+
+                    for ( size_t o = 0; o < cb; o += smallPageSize )
+                        ( (volatile uint8_t *) p )[ o ] = 0;
+                }
+            }
+#endif
+
+            return (uint8_t *) p;
+        } //OSAllocate
+
+        static void OSFree( uint8_t * p, size_t cb )
+        {
+#ifdef _WIN32
+            VirtualFree( p, 0, MEM_RELEASE );
+#else
+            munmap( p, cb );
+#endif
+        } //OSFree
+
+    public:
+        // useLargePages:  try large (Windows) or huge (Linux) pages, falling back to regular pages if unavailable
+        // maxCached:      most bytes of free buffers held for reuse; beyond that freed buffers go back to the OS
+
+        CBufferPool( bool useLargePages = false, size_t maxCached = 256 * 1024 * 1024 ) :
+            cachedBytes( 0 ), maxCachedBytes( maxCached ), largePages( false ), osAllocations( 0 ), reuses( 0 )
+        {
+            smallPageSize = SmallPageSize();
+            pageSize = smallPageSize;
+
+            if ( useLargePages )
+            {
+                size_t lps = LargePageSize();
+#ifdef _WIN32
+                largePages = ( 0 != lps ) && EnableLockMemoryPrivilege();
+#else
+                largePages = ( 0 != lps );
+#endif
+                if ( largePages )
+                    pageSize = lps;
+
+                tracer.Trace( "buffer pool large pages requested, available %d, page size %zu\n", largePages, pageSize );
+            }
+        } //CBufferPool
+
+        ~CBufferPool()
+        {
+            Trim();
+
+            if ( 0 != sizes.size() )
+                tracer.Trace( "buffer pool destroyed with %zu buffers still allocated\n", sizes.size() );
+        } //~CBufferPool
+
+        uint8_t * Allocate( size_t cb )
+        {
+            lock_guard<mutex> lock( mtx );
+
+            // under the lock; pageSize drops back to small pages if a large page allocation fails
+
+            size_t cls = SizeClass( cb );
+
+            // Accept a free buffer from the next class or two up rather than allocating
+
+            auto it = freeLists.lower_bound( cls );
+            if ( ( freeLists.end() != it ) && ( it->first <= ( cls + cls / 2 ) ) )
+            {
+                uint8_t * p = it->second.back();
+                it->second.pop_back();
+                cachedBytes -= it->first;
+
+                if ( 0 == it->second.size() )
+                    freeLists.erase( it );
+
+                reuses++;
+                return p;
+            }
+
+            uint8_t * p = OSAllocate( cls );
+
+            if ( NULL != p )
+            {
+                sizes[ p ] = cls;
+                osAllocations++;
+                tracer.Trace( "buffer pool allocated %zu bytes from the OS for a request of %zu; %zu allocations, %zu reuses\n",
+                              cls, cb, osAllocations, reuses );
+            }
+
+            return p;
+        } //Allocate
+
+        void Free( uint8_t * p )
+        {
+            if ( NULL == p )
+                return;
+
+            lock_guard<mutex> lock( mtx );
+
+            auto it = sizes.find( p );
+            if ( sizes.end() == it )
+            {
+                tracer.Trace( "buffer pool asked to free unknown buffer %p\n", p );
+                return;
+            }
+
+            size_t cls = it->second;
+
+            if ( ( cachedBytes + cls ) > maxCachedBytes )
+            {
+                sizes.erase( it );
+                OSFree( p, cls );
+                return;
+            }
+
+            freeLists[ cls ].push_back( p );
+            cachedBytes += cls;
+        } //Free
+
+        // Return all cached buffers to the OS, e.g. when nothing more will be decoded for a while
+
+        void Trim()
+        {
+            lock_guard<mutex> lock( mtx );
+
+            for ( auto & fl : freeLists )
+            {
+                for ( uint8_t * p : fl.second )
+                {
+                    sizes.erase( p );
+                    OSFree( p, fl.first );
+                }
+            }
+
+            freeLists.clear();
+            cachedBytes = 0;
+        } //Trim
+
+        size_t OSAllocations() { return osAllocations; }
+        size_t Reuses() { return reuses; }
+        bool UsingLargePages() { return largePages; }
+}; //CBufferPool
+
@@ -0,0 +1,473 @@
+#pragma once
+
+//
+// Color signatures for ordering a slideshow by color. Each file's embedded preview (or the file itself if it
+// has none) is decoded at the smallest scale the codec supports, e.g. JPEG's 1/8 DCT scaling, then hue and
+// luminance histograms of those few thousand pixels are reduced to a ULONG that sorts by dominant hue, then
+// by luminance. Results go into a CFileCache so only new or changed files are ever decoded.
+// Lookup is cheap and only reads the cache. Fill does the decoding; it's a batch job meant for a background
+// thread, saves the cache every so often and when it's done, and can be stopped part way.
+// Assumes COM has been initialized already on the calling thread.
+// Usage:
+//      CFileCache colors;
+//      colors.Load( pathOfCache );
+//      vector<CColorSignature::FileKey> missing;
+//      CColorSignature::Lookup( pathArray, colors, missing );   // sets PathItem::ulAttribute
+//      pathArray.SortOnAttribute();
+//      ... later, on a background thread
+//      CColorSignature::Fill( missing, colors, stop );
+//
+
+#include <windows.h>
+#include <shlwapi.h>
+#include <wincodec.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+#include <ppl.h>
+
+#include <djltrace.hxx>
+#include <djltimed.hxx>
+#include <djlimagedata.hxx>
+#include <djl_filecache.hxx>
+#include <djl_pa.hxx>
+
+#if defined( _M_X64 ) || defined( _M_IX86 )
+    #include <emmintrin.h>
+    #define DJL_COLORSIG_SSE2
+#endif
+
+using namespace std;
+using namespace concurrency;
+
+class CColorSignature
+{
+    public:
+        // Layout, most significant first, so an ascending sort groups photos by color:
+        //   hue bin (0..HueBins-1, or NeutralHue for photos with little color), median luminance,
+        //   fraction of colorful pixels, and SignatureVersion.
+
+        static const ULONG UnknownSignature = 0xffffffff;   // couldn't decode; sorts last
+        static const ULONG SignatureVersion = 1;
+        static const ULONG NeutralHue = 0xfe;
+        static const int HueBins = 36;
+
+        // A file to decode, copied out of the CPathArray so the playlist can change while Fill runs
+
+        struct FileKey
+        {
+            wstring path;
+            ULONGLONG size;
+            FILETIME lastWrite;
+        };
+
+    private:
+        static const UINT SampleSize = 64;       // longest side of the decoded sample
+        static const int ChromaThreshold = 40;   // max - min of B, G, R; below this a pixel counts as gray
+
+        template <typename T> static inline void SafeRelease( T *&p )
+        {
+            if ( NULL != p )
+            {
+                p->Release();
+                p = NULL;
+            }
+        } //SafeRelease
+
+        static int HueBin( int r, int g, int b, int mx, int chroma )
+        {
+            int h;
+
+            if ( mx == r )
+                h = ( 60 * ( g - b ) ) / chroma;
+            else if ( mx == g )
+                h = 120 + ( 60 * ( b - r ) ) / chroma;
+            else
+                h = 240 + ( 60 * ( r - g ) ) / chroma;
+
+            if ( h < 0 )
+                h += 360;
+
+            return ( h * HueBins / 360 ) % HueBins;
+        } //HueBin
+
+        static void CountPixel( uint32_t px, uint32_t luma, uint32_t * lumaHist, uint32_t * hueHist, size_t & colorful )
+        {
+            lumaHist[ luma ]++;
+
+            int b = px & 0xff;
+            int g = ( px >> 8 ) & 0xff;
+            int r = ( px >> 16 ) & 0xff;
+            int mx = get_max( r, get_max( g, b ) );
+            int chroma = mx - get_min( r, get_min( g, b ) );
+
+            if ( chroma >= ChromaThreshold )
+            {
+                hueHist[ HueBin( r, g, b, mx, chroma ) ]++;
+                colorful++;
+            }
+        } //CountPixel
+
+        // Decode at the smallest size the codec will produce directly, into 32bpp BGRX
+
+        static HRESULT DecodeSmallest( IWICImagingFactory * pFactory, IStream * pStream, const WCHAR * pwcPath, vector<uint32_t> & pixels, UINT & w, UINT & h )
+        {
+            IWICBitmapDecoder * pDecoder = NULL;
+            HRESULT hr = ( NULL != pStream ) ? pFactory->CreateDecoderFromStream( pStream, NULL, WICDecodeMetadataCacheOnDemand, &pDecoder ) :
+                                               pFactory->CreateDecoderFromFilename( pwcPath, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &pDecoder );
+
+            IWICBitmapFrameDecode * pFrame = NULL;
+            if ( SUCCEEDED( hr ) )
+                hr = pDecoder->GetFrame( 0, &pFrame );
+
+            UINT fullW = 0, fullH = 0;
+            if ( SUCCEEDED( hr ) )
+                hr = pFrame->GetSize( &fullW, &fullH );
+
+            if ( SUCCEEDED( hr ) && ( 0 == fullW || 0 == fullH ) )
+                hr = E_FAIL;
+
+            UINT sw = 0, sh = 0;
+            if ( SUCCEEDED( hr ) )
+            {
+                sw = ( fullW >= fullH ) ? SampleSize : get_max( 1u, (UINT) ( (ULONGLONG) fullW * SampleSize / fullH ) );
+                sh = ( fullH >= fullW ) ? SampleSize : get_max( 1u, (UINT) ( (ULONGLONG) fullH * SampleSize / fullW ) );
+                sw = get_min( sw, fullW );
+                sh = get_min( sh, fullH );
+            }
+
+            // Let the codec scale while decoding, which skips most of the work, not just most of the output
+
+            bool done = false;
+            IWICBitmapSourceTransform * pTransform = NULL;
+
+            if ( SUCCEEDED( hr ) && SUCCEEDED( pFrame->QueryInterface( IID_PPV_ARGS( &pTransform ) ) ) )
+            {
+                UINT tw = sw, th = sh;
+                WICPixelFormatGUID pf = GUID_WICPixelFormat32bppBGR;
+
+                if ( SUCCEEDED( pTransform->GetClosestSize( &tw, &th ) ) && SUCCEEDED( pTransform->GetClosestPixelFormat( &pf ) ) &&
+                     ( IsEqualGUID( pf, GUID_WICPixelFormat32bppBGR ) || IsEqualGUID( pf, GUID_WICPixelFormat24bppBGR ) ) )
+                {
+                    bool is24 = IsEqualGUID( pf, GUID_WICPixelFormat24bppBGR );
+                    UINT stride = is24 ? ( ( tw * 3 + 3 ) & ~3u ) : ( tw * 4 );
+                    vector<BYTE> raw( (size_t) stride * th );
+
+                    if ( SUCCEEDED( pTransform->CopyPixels( NULL, tw, th, &pf, WICBitmapTransformRotate0, stride, (UINT) raw.size(), raw.data() ) ) )
+                    {
+                        pixels.resize( (size_t) tw * th );
+
+                        for ( UINT y = 0; y < th; y++ )
+                        {
+                            const BYTE * prow = raw.data() + (size_t) y * stride;
+                            uint32_t * pout = pixels.data() + (size_t) y * tw;
+
+                            if ( is24 )
+                                for ( UINT x = 0; x < tw; x++ )
+                                    pout[ x ] = prow[ 3 * x ] | ( prow[ 3 * x + 1 ] << 8 ) | ( prow[ 3 * x + 2 ] << 16 );
+                            else
+                                memcpy( pout, prow, tw * sizeof( uint32_t ) );
+                        }
+
+                        w = tw;
+                        h = th;
+                        done = true;
+                    }
+                }
+            }
+
+            SafeRelease( pTransform );
+
+            // The codec can't scale natively; do a full decode through a cheap scaler
+
+            if ( SUCCEEDED( hr ) && !done )
+            {
+                IWICBitmapScaler * pScaler = NULL;
+                IWICFormatConverter * pConverter = NULL;
+
+                hr = pFactory->CreateBitmapScaler( &pScaler );
+                if ( SUCCEEDED( hr ) )
+                    hr = pScaler->Initialize( pFrame, sw, sh, WICBitmapInterpolationModeNearestNeighbor );
+                if ( SUCCEEDED( hr ) )
+                    hr = pFactory->CreateFormatConverter( &pConverter );
+                if ( SUCCEEDED( hr ) )
+                    hr = pConverter->Initialize( pScaler, GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom );
+
+                if ( SUCCEEDED( hr ) )
+                {
+                    pixels.resize( (size_t) sw * sh );
+                    hr = pConverter->CopyPixels( NULL, sw * 4, (UINT) ( pixels.size() * 4 ), (BYTE *) pixels.data() );
+                    w = sw;
+                    h = sh;
+                }
+
+                SafeRelease( pConverter );
+                SafeRelease( pScaler );
+            }
+
+            SafeRelease( pFrame );
+            SafeRelease( pDecoder );
+            return hr;
+        } //DecodeSmallest
+
+    public:
+        // Reduce BGRX pixels to a signature
+
+        static ULONG Compute( const uint32_t * pixels, size_t count )
+        {
+            if ( 0 == count )
+                return UnknownSignature;
+
+            // Four copies of the luminance histogram, used round robin, so runs of identical
+            // pixels (sky, walls) don't serialize on incrementing one counter.
+
+            uint32_t lumaHist[ 4 ][ 256 ] = {};
+            uint32_t hueHist[ HueBins ] = {};
+            size_t colorful = 0;
+            size_t i = 0;
+
+#ifdef DJL_COLORSIG_SSE2
+            // Luminance for 4 pixels at a time: ( 29 B + 150 G + 77 R + 128 ) >> 8, and
+            // a mask of which pixels are colorful enough to need their hue computed.
+
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i weights = _mm_setr_epi16( 29, 150, 77, 0, 29, 150, 77, 0 );
+            const __m128i half = _mm_set1_epi32( 128 );
+            const __m128i lowByte = _mm_set1_epi32( 0xff );
+            const __m128i threshold = _mm_set1_epi32( ChromaThreshold - 1 );
+
+            for ( ; i + 4 <= count; i += 4 )
+            {
+                __m128i p = _mm_loadu_si128( (const __m128i *) ( pixels + i ) );
+                __m128i mlo = _mm_madd_epi16( _mm_unpacklo_epi8( p, zero ), weights );   // B+G | R for pixels 0 and 1
+                __m128i mhi = _mm_madd_epi16( _mm_unpackhi_epi8( p, zero ), weights );   // ... pixels 2 and 3
+                __m128i even = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( mlo ), _mm_castsi128_ps( mhi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+                __m128i odd = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( mlo ), _mm_castsi128_ps( mhi ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+                __m128i luma = _mm_srli_epi32( _mm_add_epi32( _mm_add_epi32( even, odd ), half ), 8 );
+
+                __m128i g = _mm_srli_epi32( p, 8 );
+                __m128i r = _mm_srli_epi32( p, 16 );
+                __m128i mx = _mm_max_epu8( _mm_max_epu8( p, g ), r );
+                __m128i mn = _mm_min_epu8( _mm_min_epu8( p, g ), r );
+                __m128i chroma = _mm_and_si128( _mm_sub_epi8( mx, mn ), lowByte );
+                int colorMask = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( chroma, threshold ) ) );
+
+                uint32_t l[ 4 ];
+                _mm_storeu_si128( (__m128i *) l, luma );
+
+                lumaHist[ 0 ][ l[ 0 ] ]++;
+                lumaHist[ 1 ][ l[ 1 ] ]++;
+                lumaHist[ 2 ][ l[ 2 ] ]++;
+                lumaHist[ 3 ][ l[ 3 ] ]++;
+
+                while ( 0 != colorMask )
+                {
+                    int lane = 0;
+                    while ( 0 == ( colorMask & ( 1 << lane ) ) )
+                        lane++;
+                    colorMask &= ~( 1 << lane );
+
+                    uint32_t px = pixels[ i + lane ];
+                    int b = px & 0xff;
+                    int gg = ( px >> 8 ) & 0xff;
+                    int rr = ( px >> 16 ) & 0xff;
+                    int m = get_max( rr, get_max( gg, b ) );
+                    hueHist[ HueBin( rr, gg, b, m, m - get_min( rr, get_min( gg, b ) ) ) ]++;
+                    colorful++;
+                }
+            }
+#endif
+
+            for ( ; i < count; i++ )
+            {
+                uint32_t px = pixels[ i ];
+                uint32_t luma = ( 29 * ( px & 0xff ) + 150 * ( ( px >> 8 ) & 0xff ) + 77 * ( ( px >> 16 ) & 0xff ) + 128 ) >> 8;
+                CountPixel( px, luma, lumaHist[ i & 3 ], hueHist, colorful );
+            }
+
+            // median luminance
+
+            size_t seen = 0;
+            ULONG median = 0;
+
+            for ( int l = 0; l < 256; l++ )
+            {
+                seen += lumaHist[ 0 ][ l ] + lumaHist[ 1 ][ l ] + lumaHist[ 2 ][ l ] + lumaHist[ 3 ][ l ];
+
+                if ( seen * 2 >= count )
+                {
+                    median = l;
+                    break;
+                }
+            }
+
+            // dominant hue, smoothed over neighboring bins so a hue straddling a bin edge isn't split in two
+
+            ULONG hue = NeutralHue;
+
+            if ( colorful * 10 >= count )
+            {
+                uint32_t best = 0;
+
+                for ( int b = 0; b < HueBins; b++ )
+                {
+                    uint32_t s = hueHist[ ( b + HueBins - 1 ) % HueBins ] + 2 * hueHist[ b ] + hueHist[ ( b + 1 ) % HueBins ];
+
+                    if ( s > best )
+                    {
+                        best = s;
+                        hue = b;
+                    }
+                }
+            }
+
+            ULONG colorfulFraction = (ULONG) ( colorful * 255 / count );
+
+            return ( hue << 24 ) | ( median << 16 ) | ( colorfulFraction << 8 ) | SignatureVersion;
+        } //Compute
+
+        // Decode the file's embedded preview, or the file if there isn't one, and compute its signature
+
+        static ULONG Extract( IWICImagingFactory * pFactory, const WCHAR * pwcPath, HRESULT * phr = NULL )
+        {
+            CImageData id;
+            long long offset = 0, length = 0;
+            int orientation, w, h, fullW, fullH;
+            IStream * pStream = NULL;
+
+            if ( id.FindEmbeddedImage( pwcPath, &offset, &length, &orientation, &w, &h, &fullW, &fullH ) && ( length < 64 * 1024 * 1024 ) )
+            {
+                HANDLE hFile = CreateFile( pwcPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL );
+
+                if ( INVALID_HANDLE_VALUE != hFile )
+                {
+                    vector<BYTE> embedded( (size_t) length );
+                    LARGE_INTEGER li;
+                    li.QuadPart = offset;
+                    DWORD cbRead = 0;
+
+                    if ( SetFilePointerEx( hFile, li, NULL, FILE_BEGIN ) && ReadFile( hFile, embedded.data(), (DWORD) length, &cbRead, NULL ) && ( cbRead == length ) )
+                        pStream = SHCreateMemStream( embedded.data(), (UINT) length );
+
+                    CloseHandle( hFile );
+                }
+            }
+
+            vector<uint32_t> pixels;
+            UINT sw = 0, sh = 0;
+            HRESULT hr = DecodeSmallest( pFactory, pStream, pwcPath, pixels, sw, sh );
+
+            // some embedded previews are in formats WIC doesn't handle; the file itself may still decode
+
+            if ( FAILED( hr ) && ( NULL != pStream ) )
+                hr = DecodeSmallest( pFactory, NULL, pwcPath, pixels, sw, sh );
+
+            if ( NULL != pStream )
+                pStream->Release();
+
+            if ( NULL != phr )
+                *phr = hr;
+
+            if ( FAILED( hr ) )
+            {
+                tracer.Trace( "can't decode %ws for a color signature, hr %#x\n", pwcPath, hr );
+                return UnknownSignature;
+            }
+
+            return Compute( pixels.data(), pixels.size() );
+        } //Extract
+
+        // Set ulAttribute of every item to its cached signature, or UnknownSignature if the file has none yet.
+        // Files without one are added to missing. Returns how many are missing.
+
+        static size_t Lookup( CPathArray & paths, CFileCache & cache, vector<FileKey> & missing )
+        {
+            missing.clear();
+
+            for ( size_t i = 0; i < paths.Count(); i++ )
+            {
+                CPathArray::PathItem & pi = paths[ i ];
+                ULONG sig = UnknownSignature;
+
+                if ( !cache.Lookup( pi.pwcPath, pi.ullSize, pi.ftLastWrite, sig ) )
+                {
+                    FileKey fk = { pi.pwcPath, pi.ullSize, pi.ftLastWrite };
+                    missing.push_back( fk );
+                }
+
+                pi.ulAttribute = sig;
+            }
+
+            return missing.size();
+        } //Lookup
+
+        // Decode the files in parallel and put their signatures in the cache. Save rewrites the whole cache, so
+        // it's saved every saveMS milliseconds rather than every so many files, then once more at the end.
+        // A run that's cut short keeps most of its work. Checks stop between files.
+        // Returns the number of files decoded.
+
+        static size_t Fill( const vector<FileKey> & files, CFileCache & cache, const atomic<bool> & stop, ULONGLONG saveMS = 60000 )
+        {
+            const size_t BatchFiles = 64;   // between checks of the save interval
+
+            IWICImagingFactory * pFactory = NULL;
+            HRESULT hr = CoCreateInstance( CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS( &pFactory ) );
+
+            if ( FAILED( hr ) )
+            {
+                tracer.Trace( "unable to create WIC for color signatures %#x\n", hr );
+                return 0;
+            }
+
+            long long timeFill = 0;
+            CTimed timedFill( timeFill );
+            atomic<size_t> decoded( 0 );
+            ULONGLONG lastSave = GetTickCount64();
+
+            for ( size_t start = 0; ( start < files.size() ) && !stop; start += BatchFiles )
+            {
+                parallel_for( start, get_min( files.size(), start + BatchFiles ), [&] ( size_t i )
+                {
+                    if ( stop )
+                        return;
+
+                    // lower CPU and I/O priority so the slideshow's own decodes come first.
+                    // The WIC factory is free-threaded, but each worker thread needs COM.
+
+                    SetThreadPriority( GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN );
+                    HRESULT hrInit = CoInitializeEx( NULL, COINIT_MULTITHREADED );
+
+                    const FileKey & fk = files[ i ];
+                    HRESULT hrDecode = S_OK;
+                    ULONG sig = Extract( pFactory, fk.path.c_str(), &hrDecode );
+
+                    if ( ( UnknownSignature != sig ) || !CFileCache::IsTransientFailure( hrDecode ) )
+                        cache.Set( fk.path.c_str(), fk.size, fk.lastWrite, sig, ( UnknownSignature == sig ) ? L"can't decode" : NULL );
+
+                    decoded++;
+
+                    if ( SUCCEEDED( hrInit ) )
+                        CoUninitialize();
+
+                    SetThreadPriority( GetCurrentThread(), THREAD_MODE_BACKGROUND_END );
+                } );
+
+                if ( ( GetTickCount64() - lastSave ) >= saveMS )
+                {
+                    cache.Save();
+                    lastSave = GetTickCount64();
+                }
+            }
+
+            cache.Save();
+            pFactory->Release();
+
+            timedFill.Complete();
+            tracer.Trace( "color signatures decoded for %zu of %zu files in %lld milliseconds%s\n", decoded.load(), files.size(),
+                          timeFill / CTimed::NanoPerMilli(), stop ? "; stopped early" : "" );
+
+            return decoded;
+        } //Fill
+}; //CColorSignature
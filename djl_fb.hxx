@@ -0,0 +1,363 @@
+#pragma once
+
+//
+// Portable 32bpp BGRX software frame buffer and a compositor that tracks dirty rectangles,
+// so a window only needs to upload what changed since the last present.
+// Platform code supplies the photo pixels and renders text strips; nothing here depends on GDI.
+// Usage:
+//      CFrameCompositor comp;
+//      comp.Attach( pbits, width, height, width );
+//      comp.SetStripRenderer( renderer );
+//      comp.BeginFrame( 0 );
+//      ... draw the photo into comp.Frame()
+//      comp.EndFrame();
+//      comp.SetOverlay( 0, L"12:34", width, 0 );
+//      comp.TakeDirty( rects );   // then upload just those rects
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <unordered_map>
+
+#include <djl_os.hxx>
+
+using namespace std;
+
+struct FBRect
+{
+    int left;
+    int top;
+    int right;   // exclusive
+    int bottom;  // exclusive
+
+    int Width() const { return right - left; }
+    int Height() const { return bottom - top; }
+    bool Empty() const { return ( right <= left ) || ( bottom <= top ); }
+    long long Area() const { return Empty() ? 0 : (long long) Width() * (long long) Height(); }
+
+    FBRect Intersect( const FBRect & r ) const
+    {
+        FBRect x = { get_max( left, r.left ), get_max( top, r.top ), get_min( right, r.right ), get_min( bottom, r.bottom ) };
+        return x;
+    } //Intersect
+
+    FBRect Union( const FBRect & r ) const
+    {
+        if ( Empty() )
+            return r;
+        if ( r.Empty() )
+            return *this;
+
+        FBRect x = { get_min( left, r.left ), get_min( top, r.top ), get_max( right, r.right ), get_max( bottom, r.bottom ) };
+        return x;
+    } //Union
+};
+
+class CFrameBuffer
+{
+    private:
+        uint32_t * pixels;
+        int width;
+        int height;
+        int stride;                 // in pixels, not bytes
+        vector<uint32_t> storage;   // only used when the buffer owns its pixels
+
+    public:
+        CFrameBuffer() : pixels( NULL ), width( 0 ), height( 0 ), stride( 0 ) {}
+
+        CFrameBuffer( const CFrameBuffer & ) = delete;
+        CFrameBuffer & operator = ( const CFrameBuffer & ) = delete;
+        CFrameBuffer( CFrameBuffer && ) = default;              // moving the vector keeps its heap block, so pixels stays valid
+        CFrameBuffer & operator = ( CFrameBuffer && ) = default;
+
+        // Use memory owned by someone else, e.g. a DIB section
+
+        void Attach( uint32_t * p, int w, int h, int strideInPixels )
+        {
+            storage.clear();
+            storage.shrink_to_fit();
+            pixels = p;
+            width = w;
+            height = h;
+            stride = strideInPixels;
+        } //Attach
+
+        void Allocate( int w, int h )
+        {
+            storage.resize( (size_t) w * (size_t) h );
+            pixels = storage.data();
+            width = w;
+            height = h;
+            stride = w;
+        } //Allocate
+
+        void Detach() { Attach( NULL, 0, 0, 0 ); }
+
+        uint32_t * Pixels() { return pixels; }
+        uint32_t * Row( int y ) { return pixels + (size_t) y * (size_t) stride; }
+        const uint32_t * Row( int y ) const { return pixels + (size_t) y * (size_t) stride; }
+        int Width() const { return width; }
+        int Height() const { return height; }
+        int Stride() const { return stride; }
+        bool Ok() const { return ( NULL != pixels ) && ( 0 != width ) && ( 0 != height ); }
+
+        FBRect Bounds() const
+        {
+            FBRect r = { 0, 0, width, height };
+            return r;
+        } //Bounds
+
+        void Fill( FBRect r, uint32_t color )
+        {
+            r = r.Intersect( Bounds() );
+            if ( r.Empty() )
+                return;
+
+            for ( int y = r.top; y < r.bottom; y++ )
+            {
+                uint32_t * p = Row( y ) + r.left;
+                uint32_t * pend = p + r.Width();
+
+                while ( p < pend )
+                    *p++ = color;
+            }
+        } //Fill
+
+        // Copy srcRect of src so its top-left lands at x, y. Both sides are clipped.
+
+        void Blit( int x, int y, const CFrameBuffer & src, FBRect srcRect )
+        {
+            srcRect = srcRect.Intersect( src.Bounds() );
+            FBRect dst = { x, y, x + srcRect.Width(), y + srcRect.Height() };
+            FBRect clipped = dst.Intersect( Bounds() );
+            if ( clipped.Empty() )
+                return;
+
+            int sx = srcRect.left + ( clipped.left - dst.left );
+            int sy = srcRect.top + ( clipped.top - dst.top );
+            size_t cb = (size_t) clipped.Width() * sizeof( uint32_t );
+
+            for ( int row = 0; row < clipped.Height(); row++ )
+                memcpy( Row( clipped.top + row ) + clipped.left, src.Row( sy + row ) + sx, cb );
+        } //Blit
+
+        void Blit( int x, int y, const CFrameBuffer & src ) { Blit( x, y, src, src.Bounds() ); }
+}; //CFrameBuffer
+
+class CDirtyRects
+{
+    private:
+        vector<FBRect> rects;
+        static const size_t MaxRects = 16;  // past this, uploading the bounding box is cheaper than the bookkeeping
+
+    public:
+        void Add( FBRect r )
+        {
+            if ( r.Empty() )
+                return;
+
+            // Merge with an existing rect when the union wastes little, so a moving clock
+            // becomes one upload when the old and new spots are close and two when they're not.
+
+            for ( size_t i = 0; i < rects.size(); i++ )
+            {
+                FBRect u = rects[ i ].Union( r );
+
+                if ( u.Area() <= ( rects[ i ].Area() + r.Area() ) )
+                {
+                    rects.erase( rects.begin() + i );
+                    Add( u );
+                    return;
+                }
+            }
+
+            if ( rects.size() >= MaxRects )
+            {
+                FBRect all = r;
+                for ( size_t i = 0; i < rects.size(); i++ )
+                    all = all.Union( rects[ i ] );
+
+                rects.clear();
+                rects.push_back( all );
+                return;
+            }
+
+            rects.push_back( r );
+        } //Add
+
+        bool Empty() const { return ( 0 == rects.size() ); }
+        void Clear() { rects.clear(); }
+
+        void Take( vector<FBRect> & out )
+        {
+            out.swap( rects );
+            rects.clear();
+        } //Take
+}; //CDirtyRects
+
+class CFrameCompositor
+{
+    public:
+        // Render text into a strip sized to fit it. Called once per distinct string; the result is cached.
+
+        typedef function<bool ( const wstring & text, CFrameBuffer & strip )> StripRenderer;
+
+    private:
+        struct Overlay
+        {
+            wstring text;
+            int right;            // requested anchor: the strip's right edge and top
+            int top;
+            FBRect where;         // where the strip actually landed after clipping
+            CFrameBuffer under;   // frame pixels the strip covers, restored when the overlay changes
+            bool visible;
+
+            Overlay() : right( 0 ), top( 0 ), visible( false ) { where = FBRect(); }
+        };
+
+        CFrameBuffer frame;
+        CDirtyRects dirty;
+        StripRenderer renderer;
+        unordered_map<wstring, CFrameBuffer> strips;
+        vector<Overlay> overlays;
+        static const size_t MaxCachedStrips = 64;
+
+        CFrameBuffer * GetStrip( const wstring & text )
+        {
+            auto it = strips.find( text );
+            if ( strips.end() != it )
+                return & it->second;
+
+            if ( !renderer )
+                return NULL;
+
+            // a clock only needs a handful of strips at a time; don't let a long session accumulate 1440 of them
+
+            if ( strips.size() >= MaxCachedStrips )
+                strips.clear();
+
+            CFrameBuffer strip;
+            if ( !renderer( text, strip ) || !strip.Ok() )
+                return NULL;
+
+            return & ( strips[ text ] = std::move( strip ) );
+        } //GetStrip
+
+        void Restore( Overlay & o )
+        {
+            if ( o.visible )
+            {
+                frame.Blit( o.where.left, o.where.top, o.under );
+                dirty.Add( o.where );
+                o.visible = false;
+            }
+        } //Restore
+
+        void Show( Overlay & o )
+        {
+            CFrameBuffer * pstrip = GetStrip( o.text );
+            if ( NULL == pstrip )
+                return;
+
+            FBRect r = { o.right - pstrip->Width(), o.top, o.right, o.top + pstrip->Height() };
+            r = r.Intersect( frame.Bounds() );
+            if ( r.Empty() )
+                return;
+
+            o.where = r;
+
+            if ( ( o.under.Width() != r.Width() ) || ( o.under.Height() != r.Height() ) )
+                o.under.Allocate( r.Width(), r.Height() );
+
+            FBRect stripSrc = { r.left - ( o.right - pstrip->Width() ), r.top - o.top, 0, 0 };
+            stripSrc.right = stripSrc.left + r.Width();
+            stripSrc.bottom = stripSrc.top + r.Height();
+            o.under.Blit( 0, 0, frame, r );
+            frame.Blit( r.left, r.top, *pstrip, stripSrc );
+            dirty.Add( r );
+            o.visible = true;
+        } //Show
+
+    public:
+        void Attach( uint32_t * p, int w, int h, int strideInPixels )
+        {
+            frame.Attach( p, w, h, strideInPixels );
+            overlays.clear();
+            dirty.Clear();
+            dirty.Add( frame.Bounds() );
+        } //Attach
+
+        void Allocate( int w, int h )
+        {
+            frame.Allocate( w, h );
+            overlays.clear();
+            dirty.Clear();
+            dirty.Add( frame.Bounds() );
+        } //Allocate
+
+        void SetStripRenderer( StripRenderer r )
+        {
+            renderer = r;
+            strips.clear();
+        } //SetStripRenderer
+
+        CFrameBuffer & Frame() { return frame; }
+
+        // Start a full recomposition. Overlays are forgotten without restoring what was under them
+        // since the whole frame is about to be redrawn; EndFrame puts them back on top.
+
+        void BeginFrame( uint32_t background )
+        {
+            for ( size_t i = 0; i < overlays.size(); i++ )
+                overlays[ i ].visible = false;
+
+            frame.Fill( frame.Bounds(), background );
+            dirty.Clear();
+            dirty.Add( frame.Bounds() );
+        } //BeginFrame
+
+        void EndFrame()
+        {
+            for ( size_t i = 0; i < overlays.size(); i++ )
+                if ( !overlays[ i ].visible && ( 0 != overlays[ i ].text.size() ) )
+                    Show( overlays[ i ] );
+        } //EndFrame
+
+        // Right-align text so its strip ends at x = right, with its top at y = top.
+        // Setting the same text in the same place does nothing and dirties nothing.
+
+        void SetOverlay( size_t slot, const wchar_t * text, int right, int top )
+        {
+            if ( slot >= overlays.size() )
+                overlays.resize( slot + 1 );
+
+            Overlay & o = overlays[ slot ];
+
+            if ( o.visible && ( o.text == text ) && ( o.right == right ) && ( o.top == top ) )
+                return;
+
+            Restore( o );
+            o.text = text;
+            o.right = right;
+            o.top = top;
+            Show( o );
+        } //SetOverlay
+
+        void HideOverlay( size_t slot )
+        {
+            if ( slot < overlays.size() )
+            {
+                Restore( overlays[ slot ] );
+                overlays[ slot ].text.clear();
+            }
+        } //HideOverlay
+
+        void MarkDirty( FBRect r ) { dirty.Add( r.Intersect( frame.Bounds() ) ); }
+        bool IsDirty() const { return !dirty.Empty(); }
+        void TakeDirty( vector<FBRect> & rects ) { dirty.Take( rects ); }
+}; //CFrameCompositor
+
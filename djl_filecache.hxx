@@ -0,0 +1,262 @@
+#pragma once
+
+//
+// Persisted cache of a small per-file result, keyed by path plus the file's size and last write time.
+// An entry only matches while the file is unchanged, so edited or replaced files are looked at again.
+// Each entry holds a ULONG value and an optional note, e.g. why a file couldn't be decoded.
+// The file is rewritten whole on Save (to a temporary file, then renamed over the old one),
+// so a crash or power loss leaves either the old or the new contents.
+// Usage:
+//      CFileCache cache;
+//      cache.Load( L"c:\\users\\me\\appdata\\local\\app\\x.cache" );
+//      if ( !cache.Lookup( path, size, lastWrite, value ) )
+//          cache.Set( path, size, lastWrite, ComputeValue( path ), L"why" );
+//      cache.Save();
+//
+
+#include <windows.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <djltrace.hxx>
+
+using namespace std;
+
+class CFileCache
+{
+    private:
+        struct Entry
+        {
+            ULONGLONG size;
+            ULONGLONG lastWrite;
+            ULONG value;
+            wstring note;
+        };
+
+        struct RecordHeader
+        {
+            ULONGLONG size;
+            ULONGLONG lastWrite;
+            ULONG value;
+            USHORT pathChars;
+            USHORT noteChars;
+        };
+
+        static const ULONG Signature = 0x43464a44; // 'DJFC'
+        static const ULONG Version = 1;
+
+        std::mutex mtx;
+        unordered_map<wstring, Entry> entries;
+        wstring cachePath;
+        bool dirty;
+
+        static bool WriteAll( HANDLE h, const void * p, DWORD cb )
+        {
+            DWORD written = 0;
+            return WriteFile( h, p, cb, &written, NULL ) && ( written == cb );
+        } //WriteAll
+
+    public:
+        CFileCache() : dirty( false ) {}
+
+        static ULONGLONG FTToULL( const FILETIME & ft )
+        {
+            ULARGE_INTEGER uli;
+            uli.LowPart = ft.dwLowDateTime;
+            uli.HighPart = ft.dwHighDateTime;
+            return uli.QuadPart;
+        } //FTToULL
+
+        // Running out of memory, sharing violations, and disk or network errors say nothing about the file itself.
+        // Only a codec's verdict on the bits is worth caching.
+
+        static bool IsTransientFailure( HRESULT hr )
+        {
+            return ( E_OUTOFMEMORY == hr ) || ( FACILITY_WIN32 == HRESULT_FACILITY( hr ) ) || ( FACILITY_STORAGE == HRESULT_FACILITY( hr ) );
+        } //IsTransientFailure
+
+        // Read the cache file. A missing or corrupt file just means an empty cache.
+
+        bool Load( const WCHAR * pwcCachePath )
+        {
+            lock_guard<mutex> lock( mtx );
+
+            cachePath = pwcCachePath;
+            entries.clear();
+            dirty = false;
+
+            HANDLE hFile = CreateFile( pwcCachePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+            if ( INVALID_HANDLE_VALUE == hFile )
+                return false;
+
+            LARGE_INTEGER liSize = {};
+            GetFileSizeEx( hFile, &liSize );
+
+            vector<BYTE> data;
+            DWORD cbRead = 0;
+            bool ok = ( liSize.QuadPart >= 3 * sizeof( ULONG ) ) && ( liSize.QuadPart < 0x40000000 );
+
+            if ( ok )
+            {
+                data.resize( (size_t) liSize.QuadPart );
+                ok = ReadFile( hFile, data.data(), (DWORD) data.size(), &cbRead, NULL ) && ( cbRead == data.size() );
+            }
+
+            CloseHandle( hFile );
+
+            if ( !ok )
+                return false;
+
+            const ULONG * pheader = (const ULONG *) data.data();
+
+            if ( Signature != pheader[ 0 ] || Version != pheader[ 1 ] )
+            {
+                tracer.Trace( "file cache %ws has signature %#x version %d; ignoring it\n", pwcCachePath, pheader[ 0 ], pheader[ 1 ] );
+                return false;
+            }
+
+            ULONG count = pheader[ 2 ];
+            size_t o = 3 * sizeof( ULONG );
+
+            for ( ULONG i = 0; i < count; i++ )
+            {
+                RecordHeader rh;
+
+                if ( ( o + sizeof rh ) > data.size() )
+                    break;
+
+                memcpy( &rh, data.data() + o, sizeof rh );
+                o += sizeof rh;
+
+                size_t cbStrings = ( (size_t) rh.pathChars + rh.noteChars ) * sizeof( WCHAR );
+
+                if ( ( 0 == rh.pathChars ) || ( ( o + cbStrings ) > data.size() ) )
+                    break;
+
+                const WCHAR * pwc = (const WCHAR *) ( data.data() + o );
+                Entry & e = entries[ wstring( pwc, rh.pathChars ) ];
+                e.size = rh.size;
+                e.lastWrite = rh.lastWrite;
+                e.value = rh.value;
+                e.note.assign( pwc + rh.pathChars, rh.noteChars );
+                o += cbStrings;
+            }
+
+            if ( entries.size() != count )
+                tracer.Trace( "file cache %ws is truncated; read %zu of %d entries\n", pwcCachePath, entries.size(), count );
+
+            return true;
+        } //Load
+
+        // Write the cache back to where it was loaded from, if anything changed.
+
+        bool Save()
+        {
+            lock_guard<mutex> lock( mtx );
+
+            if ( !dirty || ( 0 == cachePath.size() ) )
+                return true;
+
+            wstring tempPath = cachePath + L".tmp";
+
+            HANDLE hFile = CreateFile( tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+            if ( INVALID_HANDLE_VALUE == hFile )
+            {
+                tracer.Trace( "can't create file cache %ws, error %d\n", tempPath.c_str(), GetLastError() );
+                return false;
+            }
+
+            // build the whole file in memory; it's one write instead of thousands of tiny ones
+
+            vector<BYTE> data;
+            ULONG header[ 3 ] = { Signature, Version, 0 };
+            data.insert( data.end(), (BYTE *) header, (BYTE *) ( header + 3 ) );
+            ULONG count = 0;
+
+            for ( auto & it : entries )
+            {
+                if ( it.first.size() > 0xffff || it.second.note.size() > 0xffff )
+                    continue;
+
+                RecordHeader rh = { it.second.size, it.second.lastWrite, it.second.value, (USHORT) it.first.size(), (USHORT) it.second.note.size() };
+                data.insert( data.end(), (BYTE *) &rh, (BYTE *) ( &rh + 1 ) );
+                data.insert( data.end(), (BYTE *) it.first.data(), (BYTE *) ( it.first.data() + it.first.size() ) );
+                data.insert( data.end(), (BYTE *) it.second.note.data(), (BYTE *) ( it.second.note.data() + it.second.note.size() ) );
+                count++;
+            }
+
+            memcpy( data.data() + 2 * sizeof( ULONG ), &count, sizeof count );
+
+            bool ok = WriteAll( hFile, data.data(), (DWORD) data.size() ) && FlushFileBuffers( hFile );
+            CloseHandle( hFile );
+
+            if ( ok )
+                ok = MoveFileEx( tempPath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH );
+
+            if ( ok )
+                dirty = false;
+            else
+            {
+                tracer.Trace( "can't write file cache %ws, error %d\n", cachePath.c_str(), GetLastError() );
+                DeleteFile( tempPath.c_str() );
+            }
+
+            return ok;
+        } //Save
+
+        // True if the file has an entry and hasn't changed since it was made.
+        // An entry for an older version of the file is dropped.
+
+        bool Lookup( const WCHAR * pwcPath, ULONGLONG size, const FILETIME & lastWrite, ULONG & value, wstring * pNote = NULL )
+        {
+            lock_guard<mutex> lock( mtx );
+
+            auto it = entries.find( pwcPath );
+            if ( entries.end() == it )
+                return false;
+
+            if ( ( size != it->second.size ) || ( FTToULL( lastWrite ) != it->second.lastWrite ) )
+            {
+                entries.erase( it );
+                dirty = true;
+                return false;
+            }
+
+            value = it->second.value;
+            if ( NULL != pNote )
+                *pNote = it->second.note;
+
+            return true;
+        } //Lookup
+
+        void Set( const WCHAR * pwcPath, ULONGLONG size, const FILETIME & lastWrite, ULONG value, const WCHAR * pwcNote = NULL )
+        {
+            lock_guard<mutex> lock( mtx );
+
+            Entry & e = entries[ pwcPath ];
+            e.size = size;
+            e.lastWrite = FTToULL( lastWrite );
+            e.value = value;
+            e.note = ( NULL == pwcNote ) ? L"" : pwcNote;
+            dirty = true;
+        } //Set
+
+        void Remove( const WCHAR * pwcPath )
+        {
+            lock_guard<mutex> lock( mtx );
+
+            if ( 0 != entries.erase( pwcPath ) )
+                dirty = true;
+        } //Remove
+
+        size_t Count()
+        {
+            lock_guard<mutex> lock( mtx );
+            return entries.size();
+        } //Count
+
+        bool IsDirty() { return dirty; }
+}; //CFileCache
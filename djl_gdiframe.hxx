@@ -0,0 +1,208 @@
+#pragma once
+
+//
+// Persistent GDI back buffer for a CFrameCompositor: a top-down 32bpp DIB section selected into a memory DC.
+// GDI, GDI+, and the portable compositor all draw into the same pixels, and Present() uploads only the
+// rectangles in the window's update region instead of the whole screen.
+// Usage:
+//      CGdiBackBuffer back;
+//      back.Create( hdc, width, height );
+//      compositor.Attach( back.Bits(), back.Width(), back.Height(), back.Width() );
+//      ...
+//      CGdiBackBuffer::Invalidate( hwnd, dirtyRects );
+//      ...WM_PAINT:
+//      CGdiBackBuffer::GetUpdateRects( hwnd, rects );
+//      HDC hdc = BeginPaint( hwnd, &ps );
+//      back.Present( hdc, rects );
+//
+
+#include <windows.h>
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <djltrace.hxx>
+#include <djl_fb.hxx>
+
+using namespace std;
+
+class CGdiBackBuffer
+{
+    private:
+        HDC hdcBack;
+        HBITMAP bmpBack;
+        HBITMAP bmpOld;
+        uint32_t * pbits;
+        int width;
+        int height;
+
+    public:
+        CGdiBackBuffer() : hdcBack( 0 ), bmpBack( 0 ), bmpOld( 0 ), pbits( NULL ), width( 0 ), height( 0 ) {}
+
+        ~CGdiBackBuffer() { Destroy(); }
+
+        // Create a 32bpp DIB section of the given size. Any previous buffer is released.
+
+        bool Create( HDC hdcRef, int w, int h )
+        {
+            Destroy();
+
+            BITMAPINFO bmi = {};
+            bmi.bmiHeader.biSize = sizeof bmi.bmiHeader;
+            bmi.bmiHeader.biWidth = w;
+            bmi.bmiHeader.biHeight = -h; // top-down, so row 0 is the top like everything else
+            bmi.bmiHeader.biPlanes = 1;
+            bmi.bmiHeader.biBitCount = 32;
+            bmi.bmiHeader.biCompression = BI_RGB;
+
+            hdcBack = CreateCompatibleDC( hdcRef );
+            if ( 0 == hdcBack )
+                return false;
+
+            void * pv = NULL;
+            bmpBack = CreateDIBSection( hdcRef, &bmi, DIB_RGB_COLORS, &pv, NULL, 0 );
+            if ( 0 == bmpBack || NULL == pv )
+            {
+                tracer.Trace( "can't create %d x %d back buffer DIB section, error %d\n", w, h, GetLastError() );
+                Destroy();
+                return false;
+            }
+
+            bmpOld = (HBITMAP) SelectObject( hdcBack, bmpBack );
+            pbits = (uint32_t *) pv;
+            width = w;
+            height = h;
+            return true;
+        } //Create
+
+        void Destroy()
+        {
+            if ( 0 != hdcBack )
+            {
+                if ( 0 != bmpOld )
+                    SelectObject( hdcBack, bmpOld );
+
+                DeleteDC( hdcBack );
+            }
+
+            if ( 0 != bmpBack )
+                DeleteObject( bmpBack );
+
+            hdcBack = 0;
+            bmpBack = 0;
+            bmpOld = 0;
+            pbits = NULL;
+            width = 0;
+            height = 0;
+        } //Destroy
+
+        bool Ok() { return ( NULL != pbits ); }
+        HDC DC() { return hdcBack; }
+        uint32_t * Bits() { return pbits; }
+        int Width() { return width; }
+        int Height() { return height; }
+
+        // Add the compositor's dirty rectangles to the window's update region
+
+        static void Invalidate( HWND hWnd, const vector<FBRect> & rects )
+        {
+            for ( size_t i = 0; i < rects.size(); i++ )
+            {
+                RECT r = { rects[ i ].left, rects[ i ].top, rects[ i ].right, rects[ i ].bottom };
+                InvalidateRect( hWnd, &r, FALSE );
+            }
+        } //Invalidate
+
+        // Call before BeginPaint validates the window; rcPaint is only the bounding box of the update region.
+
+        static void GetUpdateRects( HWND hWnd, vector<RECT> & rects )
+        {
+            rects.clear();
+
+            HRGN hrgn = CreateRectRgn( 0, 0, 0, 0 );
+            if ( 0 == hrgn )
+                return;
+
+            int kind = GetUpdateRgn( hWnd, hrgn, FALSE );
+
+            if ( SIMPLEREGION == kind || COMPLEXREGION == kind )
+            {
+                DWORD cb = GetRegionData( hrgn, 0, NULL );
+                unique_ptr<BYTE[]> data( new BYTE[ cb ] );
+                RGNDATA * prd = (RGNDATA *) data.get();
+
+                if ( cb == GetRegionData( hrgn, cb, prd ) )
+                {
+                    RECT * pr = (RECT *) prd->Buffer;
+                    rects.assign( pr, pr + prd->rdh.nCount );
+                }
+            }
+
+            DeleteObject( hrgn );
+        } //GetUpdateRects
+
+        void Present( HDC hdc, const vector<RECT> & rects )
+        {
+            GdiFlush(); // the compositor writes the DIB bits directly; make sure GDI is done with them too
+
+            for ( size_t i = 0; i < rects.size(); i++ )
+            {
+                const RECT & r = rects[ i ];
+                BitBlt( hdc, r.left, r.top, r.right - r.left, r.bottom - r.top, hdcBack, r.left, r.top, SRCCOPY );
+            }
+        } //Present
+}; //CGdiBackBuffer
+
+// Renders text strips for CFrameCompositor overlays with a GDI font, opaque on a solid background.
+
+class CGdiTextStrips
+{
+    private:
+        HFONT font;
+        COLORREF crText;
+        COLORREF crBack;
+
+    public:
+        CGdiTextStrips( HFONT f, COLORREF text, COLORREF back ) : font( f ), crText( text ), crBack( back ) {}
+
+        bool Render( const wstring & text, CFrameBuffer & strip )
+        {
+            HDC hdc = CreateCompatibleDC( NULL );
+            if ( 0 == hdc )
+                return false;
+
+            HFONT fontOld = (HFONT) SelectObject( hdc, font );
+            SIZE size = {};
+            GetTextExtentPoint32( hdc, text.c_str(), (int) text.size(), &size );
+
+            bool ok = false;
+
+            if ( 0 != size.cx && 0 != size.cy )
+            {
+                CGdiBackBuffer dib;
+
+                if ( dib.Create( hdc, size.cx, size.cy ) )
+                {
+                    HFONT fontOldDib = (HFONT) SelectObject( dib.DC(), font );
+                    SetBkColor( dib.DC(), crBack );
+                    SetTextColor( dib.DC(), crText );
+                    RECT r = { 0, 0, size.cx, size.cy };
+                    ExtTextOut( dib.DC(), 0, 0, ETO_OPAQUE, &r, text.c_str(), (UINT) text.size(), NULL );
+                    SelectObject( dib.DC(), fontOldDib );
+                    GdiFlush();
+
+                    CFrameBuffer src;
+                    src.Attach( dib.Bits(), dib.Width(), dib.Height(), dib.Width() );
+                    strip.Allocate( size.cx, size.cy );
+                    strip.Blit( 0, 0, src );
+                    ok = true;
+                }
+            }
+
+            SelectObject( hdc, fontOld );
+            DeleteDC( hdc );
+            return ok;
+        } //Render
+}; //CGdiTextStrips
+
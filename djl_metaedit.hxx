@@ -0,0 +1,360 @@
+#pragma once
+
+//
+// Batch editor for the in-place rating and orientation patches CImageData makes one file at a time.
+// Each file is opened once for all of its edits, parsed only if its patch locations aren't already
+// cached for the same size and last write time, and the bytes being replaced are checked first so a
+// stale offset can't corrupt a file. Files are processed in parallel.
+// Each file's edits are flushed to disk before the edit reports success, and its last write time is
+// set explicitly so the next batch can trust its cached offsets.
+// The cached offsets live only as long as the CMetadataEditor; keep one around across batches to reuse
+// them. A new instance, e.g. in a new process, parses every file again.
+// Usage:
+//      CMetadataEditor editor;
+//      vector<CMetadataEditor::Edit> edits;
+//      edits.push_back( CMetadataEditor::MakeEdit( path, CMetadataEditor::editSetRating, 3 ) );
+//      size_t applied = editor.Apply( edits );
+//      ... edits[ i ].ok and edits[ i ].newValue hold the results
+//
+
+#include <windows.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <ppl.h>
+
+#include <djltrace.hxx>
+#include <djlimagedata.hxx>
+#include <djl_filecache.hxx>
+
+using namespace std;
+using namespace concurrency;
+
+class CMetadataEditor
+{
+    public:
+        enum EditKind { editSetRating, editToggleRating, editSetOrientation, editRotate };
+
+        struct Edit
+        {
+            const WCHAR * pwcPath;
+            EditKind kind;
+            int value;           // rating 0..5, orientation 1..8, or for editRotate non-zero to rotate right
+            bool ok;             // set by Apply
+            int newValue;        // the rating or orientation now in the file if ok
+        };
+
+        static Edit MakeEdit( const WCHAR * pwcPath, EditKind kind, int value = 0 )
+        {
+            Edit e = { pwcPath, kind, value, false, -1 };
+            return e;
+        } //MakeEdit
+
+    private:
+        struct CachedFile
+        {
+            ULONGLONG size;
+            ULONGLONG lastWrite;
+            CImageData::PatchLocations loc;
+        };
+
+        std::mutex mtx;
+        unordered_map<wstring, CachedFile> cache;   // lowercase path => where to patch it
+
+        static wstring Key( const WCHAR * pwcPath )
+        {
+            wstring key( pwcPath );
+            for ( size_t i = 0; i < key.size(); i++ )
+                key[ i ] = towlower( key[ i ] );
+            return key;
+        } //Key
+
+        static bool ReadAt( HANDLE hFile, __int64 offset, void * p, DWORD cb )
+        {
+            LARGE_INTEGER li;
+            li.QuadPart = offset;
+            DWORD cbRead = 0;
+            return SetFilePointerEx( hFile, li, NULL, FILE_BEGIN ) && ReadFile( hFile, p, cb, &cbRead, NULL ) && ( cbRead == cb );
+        } //ReadAt
+
+        static bool WriteAt( HANDLE hFile, __int64 offset, const void * p, DWORD cb )
+        {
+            LARGE_INTEGER li;
+            li.QuadPart = offset;
+            DWORD written = 0;
+            return SetFilePointerEx( hFile, li, NULL, FILE_BEGIN ) && WriteFile( hFile, p, cb, &written, NULL ) && ( written == cb );
+        } //WriteAt
+
+        static WORD RotateOrientation( int value, bool rotateRight )
+        {
+            // 1 --> 6 --> 3 --> 8 --> 1 ...
+
+            static const WORD right[ 9 ] = { 0, 6, 0, 8, 0, 0, 3, 0, 1 };
+            static const WORD left[ 9 ] = { 0, 8, 0, 6, 0, 0, 1, 0, 3 };
+
+            return rotateRight ? right[ value ] : left[ value ];
+        } //RotateOrientation
+
+        static bool ValidateOrientation( HANDLE hFile, __int64 offset, int value, bool littleEndian )
+        {
+            WORD w = 0;
+            if ( !ReadAt( hFile, offset, &w, sizeof w ) )
+                return false;
+
+            if ( !littleEndian )
+                w = _byteswap_ushort( w );
+
+            return ( w == value );
+        } //ValidateOrientation
+
+        // The bytes about to be replaced must be what the parse said they are, including the second orientation copy
+
+        static bool Validate( HANDLE hFile, const CImageData::PatchLocations & loc, bool rating )
+        {
+            if ( rating )
+            {
+                char c = 0;
+                return ReadAt( hFile, loc.ratingOffset, &c, sizeof c ) && ( c == ( '0' + loc.rating ) );
+            }
+
+            if ( !ValidateOrientation( hFile, loc.orientationOffset, loc.orientationValue, loc.orientationLittleEndian ) )
+                return false;
+
+            return ( 0 == loc.orientationOffset2 ) ||
+                   ValidateOrientation( hFile, loc.orientationOffset2, loc.orientationValue2, loc.orientationLittleEndian );
+        } //Validate
+
+        // Apply one edit to an open file and loc, which describes the file as it is now. False if the file can't take it.
+
+        static bool ApplyEdit( HANDLE hFile, CImageData::PatchLocations & loc, Edit & edit )
+        {
+            if ( editSetRating == edit.kind || editToggleRating == edit.kind )
+            {
+                if ( 0 == loc.ratingOffset )
+                {
+                    tracer.Trace( "file %ws has no rating field, so it can't be updated\n", edit.pwcPath );
+                    return false;
+                }
+
+                int rating = edit.value;
+
+                if ( editToggleRating == edit.kind )
+                    rating = ( loc.rating >= 0 && loc.rating <= 4 ) ? ( 1 + loc.rating ) : 0;
+                else if ( rating < 0 || rating > 5 )
+                {
+                    tracer.Trace( "rating %d for file %ws isn't 0..5\n", rating, edit.pwcPath );
+                    return false;
+                }
+
+                char c = (char) ( '0' + rating );
+                if ( !WriteAt( hFile, loc.ratingOffset, &c, sizeof c ) )
+                {
+                    tracer.Trace( "can't write new rating to file %ws, error %d\n", edit.pwcPath, GetLastError() );
+                    return false;
+                }
+
+                loc.rating = (char) rating;
+                edit.newValue = rating;
+                return true;
+            }
+
+            if ( ( -1 == loc.orientationValue ) || ( 0 == loc.orientationOffset ) || ( 3 != loc.orientationType ) )
+            {
+                tracer.Trace( "file %ws has no orientation that can be updated; value %d, type %d\n", edit.pwcPath, loc.orientationValue, loc.orientationType );
+                return false;
+            }
+
+            int current = ( loc.orientationValue > 8 || loc.orientationValue < 1 ) ? 1 : loc.orientationValue;
+            WORD o = 0;
+
+            if ( editRotate == edit.kind )
+                o = RotateOrientation( current, 0 != edit.value );
+            else if ( edit.value >= 1 && edit.value <= 8 )
+                o = (WORD) edit.value;
+
+            if ( 0 == o )
+            {
+                tracer.Trace( "orientation %d of file %ws can't be changed to or rotated with %d\n", current, edit.pwcPath, edit.value );
+                return false;
+            }
+
+            // Lightroom sometimes stores the orientation twice; different apps look at different copies, so update both
+
+            WORD oToWrite = loc.orientationLittleEndian ? o : _byteswap_ushort( o );
+            bool ok = WriteAt( hFile, loc.orientationOffset, &oToWrite, sizeof oToWrite );
+
+            if ( ok && ( 0 != loc.orientationOffset2 ) )
+                ok = WriteAt( hFile, loc.orientationOffset2, &oToWrite, sizeof oToWrite );
+
+            if ( !ok )
+            {
+                tracer.Trace( "can't write orientation to file %ws, error %d\n", edit.pwcPath, GetLastError() );
+                return false;
+            }
+
+            loc.orientationValue = o;
+            if ( 0 != loc.orientationOffset2 )
+                loc.orientationValue2 = o;
+            edit.newValue = o;
+            return true;
+        } //ApplyEdit
+
+        // All edits for one file, with one open
+
+        void ApplyFile( vector<Edit> & edits, const vector<size_t> & group, bool durable )
+        {
+            const WCHAR * pwcPath = edits[ group[ 0 ] ].pwcPath;
+            wstring key = Key( pwcPath );
+
+            HANDLE hFile = CreateFile( pwcPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL );
+            if ( INVALID_HANDLE_VALUE == hFile )
+            {
+                tracer.Trace( "can't open file %ws for write to update metadata, error %d\n", pwcPath, GetLastError() );
+                return;
+            }
+
+            BY_HANDLE_FILE_INFORMATION info;
+            if ( !GetFileInformationByHandle( hFile, &info ) )
+            {
+                CloseHandle( hFile );
+                return;
+            }
+
+            ULARGE_INTEGER size;
+            size.LowPart = info.nFileSizeLow;
+            size.HighPart = info.nFileSizeHigh;
+
+            CachedFile cf = {};
+            bool cached = false;
+
+            {
+                lock_guard<mutex> lock( mtx );
+                auto it = cache.find( key );
+
+                if ( ( cache.end() != it ) && ( size.QuadPart == it->second.size ) && ( CFileCache::FTToULL( info.ftLastWriteTime ) == it->second.lastWrite ) )
+                {
+                    cf = it->second;
+                    cached = true;
+                }
+            }
+
+            CImageData id;
+            bool parsed = !cached && id.GetPatchLocations( hFile, pwcPath, cf.loc );
+            bool anyWritten = false;
+
+            for ( size_t i = 0; i < group.size(); i++ )
+            {
+                Edit & edit = edits[ group[ i ] ];
+                bool rating = ( editSetRating == edit.kind || editToggleRating == edit.kind );
+                bool present = rating ? ( 0 != cf.loc.ratingOffset ) : ( 0 != cf.loc.orientationOffset );
+
+                // A file changed behind the cache's back without its size or time changing; parse it again, once
+
+                if ( present && !Validate( hFile, cf.loc, rating ) && !parsed )
+                {
+                    tracer.Trace( "cached metadata offsets for %ws are stale; reparsing\n", pwcPath );
+                    parsed = id.GetPatchLocations( hFile, pwcPath, cf.loc );
+                    present = rating ? ( 0 != cf.loc.ratingOffset ) : ( 0 != cf.loc.orientationOffset );
+                }
+
+                if ( present && !Validate( hFile, cf.loc, rating ) )
+                {
+                    tracer.Trace( "file %ws doesn't hold the expected %s bytes; not patching it\n", pwcPath, rating ? "rating" : "orientation" );
+                    continue;
+                }
+
+                edit.ok = ApplyEdit( hFile, cf.loc, edit );
+                anyWritten |= edit.ok;
+            }
+
+            if ( anyWritten )
+            {
+                // Stamp the time now; NTFS would otherwise set it at close, and the cache couldn't know it.
+                // The flush makes the patches durable before any of them is reported as done.
+
+                FILETIME ftNow;
+                GetSystemTimeAsFileTime( &ftNow );
+                SetFileTime( hFile, NULL, NULL, &ftNow );
+                info.ftLastWriteTime = ftNow;
+
+                if ( durable && !FlushFileBuffers( hFile ) )
+                {
+                    tracer.Trace( "can't flush metadata edits to %ws, error %d\n", pwcPath, GetLastError() );
+
+                    for ( size_t i = 0; i < group.size(); i++ )
+                        edits[ group[ i ] ].ok = false;
+
+                    cached = false;
+                    parsed = false; // don't trust what's on disk next time
+                }
+            }
+
+            CloseHandle( hFile );
+
+            lock_guard<mutex> lock( mtx );
+
+            if ( cached || parsed )
+            {
+                cf.size = size.QuadPart;
+                cf.lastWrite = CFileCache::FTToULL( info.ftLastWriteTime );
+                cache[ key ] = cf;
+            }
+            else
+                cache.erase( key );
+        } //ApplyFile
+
+    public:
+        // Apply the edits, in order within each file, with files processed in parallel.
+        // durable: flush each file before reporting its edits as done.
+        // Returns the number of edits applied.
+
+        size_t Apply( vector<Edit> & edits, bool durable = true )
+        {
+            for ( size_t i = 0; i < edits.size(); i++ )
+            {
+                edits[ i ].ok = false;
+                edits[ i ].newValue = -1;
+            }
+
+            // group edits by file, keeping their order, so each file is opened once
+
+            vector<size_t> order( edits.size() );
+            for ( size_t i = 0; i < order.size(); i++ )
+                order[ i ] = i;
+
+            stable_sort( order.begin(), order.end(), [&] ( size_t a, size_t b ) { return _wcsicmp( edits[ a ].pwcPath, edits[ b ].pwcPath ) < 0; } );
+
+            vector<vector<size_t>> groups;
+
+            for ( size_t i = 0; i < order.size(); i++ )
+            {
+                if ( ( 0 == i ) || _wcsicmp( edits[ order[ i ] ].pwcPath, edits[ order[ i - 1 ] ].pwcPath ) )
+                    groups.push_back( vector<size_t>() );
+
+                groups.back().push_back( order[ i ] );
+            }
+
+            parallel_for( (size_t) 0, groups.size(), [&] ( size_t g )
+            {
+                ApplyFile( edits, groups[ g ], durable );
+            } );
+
+            size_t applied = 0;
+            for ( size_t i = 0; i < edits.size(); i++ )
+                applied += edits[ i ].ok;
+
+            tracer.Trace( "applied %zu of %zu metadata edits across %zu files\n", applied, edits.size(), groups.size() );
+            return applied;
+        } //Apply
+
+        // Forget cached patch locations, e.g. if files may have been edited by another app without changing their times
+
+        void PurgeCache()
+        {
+            lock_guard<mutex> lock( mtx );
+            cache.clear();
+        } //PurgeCache
+}; //CMetadataEditor
@@ -9,6 +9,7 @@
 #include <djltimed.hxx>
 
 #include <random>
+#include <algorithm>
 #include <ppl.h>
 
 using namespace concurrency;
@@ -22,6 +23,7 @@ class CPathArray
             FILETIME ftCreation;
             FILETIME ftLastWrite;
             FILETIME ftCapture;
+            ULONGLONG ullSize;     // 0 if not known
             ULONG ulAttribute;     // can be used to sort on anything, e.g. primary color
         };
 
@@ -153,7 +155,7 @@ class CPathArray
         {
             for ( size_t i = 0; i < elements.size(); i++ )
             {
-                delete elements[ i ].pwcPath;
+                delete [] elements[ i ].pwcPath;
                 elements[ i ].pwcPath = NULL;
             }
 
@@ -178,6 +180,20 @@ class CPathArray
             }
         } //Randomize
 
+        // Keep the order but start at a random item, e.g. so a sorted playlist doesn't open the same way every time
+
+        void RotateRandomly()
+        {
+            if ( elements.size() <= 1 )
+                return;
+
+            std::random_device rd;
+            std::mt19937 gen( rd() );
+            std::uniform_int_distribution<size_t> distrib( 0, elements.size() - 1 );
+
+            rotate( elements.begin(), elements.begin() + distrib( gen ), elements.end() );
+        } //RotateRandomly
+
         void SortOnAttribute( bool ascending = true )
         {
             qsort( elements.data(), elements.size(), sizeof PathItem, ascending ? PIAttributeCompare : PIAttributeCompareDescending );
@@ -226,7 +242,7 @@ class CPathArray
                         st.wHour = (WORD) atoi( dateTime + 11 );
                         st.wMinute = (WORD) atoi( dateTime + 14 );
                         st.wSecond = (WORD) atoi( dateTime + 17 );
-                        tracer.Trace( "parsed time '%s': %d, %d, %d, %d, %d, %d\n", dateTime, st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond );
+                        tracer.TraceFast<traceVerbose>( "parsed time '%s': %d, %d, %d, %d, %d, %d\n", dateTime, st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond );
 
                         SystemTimeToFileTime( &st, &elements[i].ftCapture );
                     }
@@ -254,11 +270,12 @@ class CPathArray
                 swap( elements[ t++ ], elements[ b-- ] );
         } //InvertSort
 
-        void Add( WCHAR * pwc, FILETIME & creation, FILETIME & lastWrite )
+        void Add( WCHAR * pwc, FILETIME & creation, FILETIME & lastWrite, ULONGLONG size = 0 )
         {
-            PathItem pi;
+            PathItem pi = {};
             pi.ftCreation = creation;
             pi.ftLastWrite = lastWrite;
+            pi.ullSize = size;
             size_t len = 1 + wcslen( pwc );
             pi.pwcPath = new WCHAR[ len ];
             wcscpy_s( pi.pwcPath, len, pwc );
@@ -304,7 +321,7 @@ class CPathArray
             if ( item >= elements.size() )
                 return false;
 
-            delete elements[ item ].pwcPath;
+            delete [] elements[ item ].pwcPath;
             elements[ item ].pwcPath = NULL;
 
             elements.erase( elements.begin() + item );
@@ -312,5 +329,36 @@ class CPathArray
             tracer.Trace( "after deleting CPathArray item, new size %zu\n", elements.size() );
             return true;
         }
+
+        // Delete every item the predicate accepts in one pass. Returns the number deleted.
+
+        template <typename T> size_t DeleteIf( T pred )
+        {
+            size_t kept = 0;
+
+            for ( size_t i = 0; i < elements.size(); i++ )
+            {
+                if ( pred( elements[ i ] ) )
+                {
+                    delete [] elements[ i ].pwcPath;
+                    elements[ i ].pwcPath = NULL;
+                }
+                else
+                    elements[ kept++ ] = elements[ i ];
+            }
+
+            size_t deleted = elements.size() - kept;
+            elements.resize( kept );
+            return deleted;
+        } //DeleteIf
+
+        // Move every item the predicate accepts to the end, keeping the relative order of both groups.
+        // Returns the number moved.
+
+        template <typename T> size_t MoveToEnd( T pred )
+        {
+            auto it = stable_partition( elements.begin(), elements.end(), [&] ( PathItem & pi ) { return !pred( pi ); } );
+            return elements.end() - it;
+        } //MoveToEnd
 }; //CPathArray
 
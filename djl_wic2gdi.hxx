@@ -5,6 +5,10 @@
 // Usage:
 //      CWic2Gdi wic2gdi;
 //      Bitmap * pbitmap = wic2gdi.GDIBitmapFromWIC( ... );
+//      ...
+//      delete pbitmap;
+//      wic2gdi.FreeBuffer( buffer );
+// Pass a CBufferPool to the constructor to recycle pixel buffers across images.
 //
 
 #include <windows.h>
@@ -15,12 +19,14 @@
 #include <wincodec.h>
 
 #include <djltrace.hxx>
+#include <djl_bufpool.hxx>
 
 class CWic2Gdi
 {
     private:
 
         IWICImagingFactory * pIWICFactory;
+        CBufferPool * pBufferPool;          // may be NULL, in which case buffers come from new[]
 
         template <typename T> static inline void SafeRelease( T *&p )
         {
@@ -39,8 +45,16 @@ class CWic2Gdi
             return x + 4 - remainder;
         } //RoundUpTo4
 
-        static HRESULT CreateBitmapFromBitmapSource( IWICBitmapSource *pBitmapSource, Bitmap ** ppBitmap, byte **ppBuffer,
-                                                     WICPixelFormatGUID & wicPixelFormat, DWORD gdipPixelFormat )
+        byte * AllocateBuffer( UINT cb )
+        {
+            if ( NULL != pBufferPool )
+                return pBufferPool->Allocate( cb );
+
+            return new BYTE[ cb ];
+        } //AllocateBuffer
+
+        HRESULT CreateBitmapFromBitmapSource( IWICBitmapSource *pBitmapSource, Bitmap ** ppBitmap, byte **ppBuffer,
+                                              WICPixelFormatGUID & wicPixelFormat, DWORD gdipPixelFormat )
         {
             *ppBuffer = NULL;
             WICPixelFormatGUID pixelFormat;
@@ -70,7 +84,13 @@ class CWic2Gdi
                     cbStride = RoundUpTo4( 3 * width );
 
                 UINT cbBufferSize = cbStride * height;
-                BYTE *pbBuffer  = new BYTE[ cbBufferSize ];
+                BYTE *pbBuffer  = AllocateBuffer( cbBufferSize );
+
+                if ( NULL == pbBuffer )
+                {
+                    tracer.Trace( "  can't allocate %u bytes for the bitmap buffer\n", cbBufferSize );
+                    return E_OUTOFMEMORY;
+                }
         
                 // The WIC plugin decoder is invoked in CopyPixels(), which means many failure modes are inevitable.
                 // For example, Canon .HIF files fail at CopyPixels(). The transforms happen here as well.
@@ -86,7 +106,7 @@ class CWic2Gdi
                 else
                 {
                     tracer.Trace( "  CreateBitmapFromBitmapSource failed in CopyPixels; likely a codec failure, hr %#x\n", hr );
-                    delete pbBuffer;
+                    FreeBuffer( pbBuffer );
                     pbBuffer = NULL;
                 }
         
@@ -341,15 +361,27 @@ class CWic2Gdi
             return ResizeBitmapQuality( pb, w, h, pf );
         } //ResizeGDIPBitmap
 
+        // Release a buffer returned by GDIPBitmapFromWIC. Delete the Bitmap that references it first.
+
+        void FreeBuffer( byte * pBuffer )
+        {
+            if ( NULL != pBufferPool )
+                pBufferPool->Free( pBuffer );
+            else
+                delete [] pBuffer;
+        } //FreeBuffer
+
         // pwcPath: path of input file or NULL to use pStream
         // pStream: stream of input or NULL to use pwcPath
-        // ppBuffer: returns a byte array of the bits held in the returned bitmap or NULL if not needed
+        // ppBuffer: returns a byte array of the bits held in the returned bitmap or NULL if not needed. Release with FreeBuffer()
         // targetW / targetH: size of the intended window, so the image can be rescaled or 0 to indicate no scaling
         // availableWidth / availableHeight: full original dimensions of the bitmap
         // gdipPixelFormat: pixel format of the GDI+ bitmap created.
+        // phr: returns why no bitmap was returned, e.g. to tell a codec failure from running out of memory. May be NULL.
 
         Bitmap * GDIPBitmapFromWIC( WCHAR * pwcPath, IStream * pStream, byte **ppBuffer, int targetW, int targetH,
-                                    int * availableWidth, int * availableHeight, DWORD gdipPixelFormat = PixelFormat32bppRGB )
+                                    int * availableWidth, int * availableHeight, DWORD gdipPixelFormat = PixelFormat32bppRGB,
+                                    HRESULT * phr = NULL )
         {
         
             //tracer.Trace( "opening %ws\n", pwcPath );
@@ -365,6 +397,8 @@ class CWic2Gdi
             else
             {
                 tracer.Trace( "unsupported GDI+ PixelFormat %#x\n", gdipPixelFormat );
+                if ( NULL != phr )
+                    *phr = E_INVALIDARG;
                 return 0;
             }
         
@@ -515,6 +549,9 @@ class CWic2Gdi
             SafeRelease( pDecoder );
             SafeRelease( pFrame );
 
+            if ( NULL != phr )
+                *phr = hr;
+
             // Instead of rotating in the WIC pipeline above, do it here.
 
             if ( pBitmap && orientation )
@@ -536,9 +573,10 @@ class CWic2Gdi
             return pBitmap;
         } //GDIPBitmapFromWIC
 
-        CWic2Gdi()
+        CWic2Gdi( CBufferPool * pool = NULL )
         {
             pIWICFactory = 0;
+            pBufferPool = pool;
 
             HRESULT hr = CoCreateInstance( CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS( &pIWICFactory ) );
 
@@ -128,7 +128,12 @@ class CEnumFolder
                             else if ( HasValidExtension( fd.cFileName ) )
                             {
                                 if ( 0 != resultPaths )
-                                    resultPaths->Add( awc, fd.ftCreationTime, fd.ftLastWriteTime );
+                                {
+                                    ULARGE_INTEGER size;
+                                    size.LowPart = fd.nFileSizeLow;
+                                    size.HighPart = fd.nFileSizeHigh;
+                                    resultPaths->Add( awc, fd.ftCreationTime, fd.ftLastWriteTime, size.QuadPart );
+                                }
                                 if ( 0 != resultStrings )
                                     resultStrings->Add( awc );
                             }
@@ -3740,6 +3740,45 @@ public:
         return ok;
     } //RotateImage
 
+    // Where a rating or orientation edit would patch the file, for callers that write the bytes themselves
+
+    struct PatchLocations
+    {
+        __int64 ratingOffset;          // 0 if the file has no XMP rating
+        char rating;                   // 0..5
+        __int64 orientationOffset;     // 0 if the file has no orientation
+        __int64 orientationOffset2;    // 0 unless the orientation is stored a second time
+        int orientationValue;          // -1 if not set
+        int orientationValue2;         // the second copy's value when orientationOffset2 is set
+        int orientationType;           // 3 (SHORT) is the only type that can be patched
+        bool orientationLittleEndian;
+    };
+
+    // Parse a file that's already open, e.g. for write. The single-file cache is bypassed and left empty,
+    // since the caller is about to change what was parsed.
+
+    bool GetPatchLocations( HANDLE hFile, const WCHAR * pwcPath, PatchLocations & loc )
+    {
+        lock_guard<mutex> lock( g_mtx );
+
+        InitializeGlobals();
+        g_awcPath[ 0 ] = 0;
+        EnumerateImageData( hFile, pwcPath );
+
+        loc.ratingOffset = g_RatingInXMP_Offset;
+        loc.rating = g_RatingInXMP;
+        loc.orientationOffset = g_Orientation_Offset;
+        loc.orientationOffset2 = ( -1 != g_Orientation_Value2 ) ? g_Orientation_Offset2 : 0;
+        loc.orientationValue = g_Orientation_Value;
+        loc.orientationValue2 = g_Orientation_Value2;
+        loc.orientationType = (int) g_Orientation_Type;
+        loc.orientationLittleEndian = g_Orientation_LittleEndian;
+
+        InitializeGlobals();
+
+        return ( 0 != loc.ratingOffset ) || ( 0 != loc.orientationOffset );
+    } //GetPatchLocations
+
     void PurgeCache()
     {
         InitializeGlobals();
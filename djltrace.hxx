@@ -8,6 +8,19 @@
 // Arguments to Trace() are just like printf. e.g.:
 //    tracer.Trace( "what to log with an integer argument %d and a wide string %ws\n", 10, pwcHello );
 //
+// For hot paths, TraceFast doesn't format or take a lock on the calling thread. It copies the format
+// pointer and the raw arguments (strings are copied, truncated) into a per-thread ring buffer, and a
+// background thread formats and writes them in timestamp order. Records are dropped, never waited for,
+// when a ring is full. Calls above DJL_TRACE_LEVEL compile to nothing.
+// While the ring is enabled, Trace output is formatted by the caller and queued in the same ring so the
+// two stay in order; it reaches the file at the next flush. A Trace line is never dropped: if it doesn't
+// fit, the rings are drained and it's written directly.
+// A thread's ring is freed at the first flush after the thread exits, so short-lived threads don't add up.
+//    tracer.EnableBinaryRing( true );
+//    tracer.TraceFast<traceVerbose>( "message %#x\n", message );
+//    tracer.EnableBinaryRing( false ); // drains what's left; call before the process exits
+// The format must be a string literal or otherwise outlive the flush. '*' widths aren't supported.
+//
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +33,17 @@
 #include <cstring>
 #include <djl_os.hxx>
 
+#ifndef WATCOM
+    #include <wchar.h>
+    #include <atomic>
+    #include <thread>
+    #include <chrono>
+    #include <string>
+    #include <algorithm>
+    #include <type_traits>
+    #include <condition_variable>
+#endif
+
 #if !defined(_WIN32) && !defined(WATCOM)
 
     #include <sys/unistd.h>
@@ -30,6 +54,14 @@
 
 using namespace std;
 
+// TraceFast calls with a level above DJL_TRACE_LEVEL are compiled out
+
+enum TraceLevel { traceOff = 0, traceError = 1, traceInfo = 2, traceVerbose = 3 };
+
+#ifndef DJL_TRACE_LEVEL
+    #define DJL_TRACE_LEVEL traceVerbose
+#endif
+
 class CDJLTrace
 {
     private:
@@ -40,6 +72,464 @@ class CDJLTrace
         bool quiet; // no pid
         bool flush; // flush after each write
 
+#ifndef WATCOM
+        enum RingArgType : uint8_t { ringInt32, ringInt64, ringDouble, ringPointer, ringString, ringWideString };
+
+        struct RecordHeader
+        {
+            uint32_t size;            // whole record including this header, a multiple of 8
+            uint32_t argBytes;
+            uint64_t ticks;           // steady_clock; the flusher sorts on this to merge the rings
+            const char * format;      // NULL for the filler at the end of the ring before it wraps, TextFormat() for Trace output
+        };
+
+        // Written only by its thread and read by one drainer at a time, so head and tail are all the synchronization needed
+
+        struct TraceRing
+        {
+            vector<uint8_t> buffer;   // size is a power of 2
+            atomic<size_t> head;      // total bytes produced
+            atomic<size_t> tail;      // total bytes consumed
+            atomic<size_t> dropped;
+            atomic<bool> retired;     // set when the thread exits; the drainer frees the ring once it's empty
+
+            TraceRing( size_t cb ) : buffer( cb ), head( 0 ), tail( 0 ), dropped( 0 ), retired( false ) {}
+        };
+
+        // Each thread's reference to its ring. The tracer holds the other, so neither outlives the memory.
+
+        struct RingOwner
+        {
+            shared_ptr<TraceRing> ring;
+
+            ~RingOwner()
+            {
+                if ( ring )
+                    ring->retired.store( true, memory_order_release );
+            }
+        };
+
+        static const size_t MaxRecord = 1024;
+        static const size_t MaxStringArg = 255;
+
+        struct RecordBuilder
+        {
+            uint8_t data[ MaxRecord ];
+            size_t len;
+            bool full;
+
+            RecordBuilder() : len( sizeof( RecordHeader ) ), full( false ) {}
+
+            void Put( const void * p, size_t cb )
+            {
+                if ( full || ( ( len + cb ) > MaxRecord ) )
+                {
+                    full = true; // later arguments are left off; the formatter prints their specs as-is
+                    return;
+                }
+
+                memcpy( data + len, p, cb );
+                len += cb;
+            } //Put
+
+            template <typename T> void PutValue( RingArgType type, T v )
+            {
+                if ( !full && ( ( len + 1 + sizeof v ) <= MaxRecord ) )
+                {
+                    Put( &type, 1 );
+                    Put( &v, sizeof v );
+                }
+                else
+                    full = true;
+            } //PutValue
+
+            template <typename C> void PutString( RingArgType type, const C * p )
+            {
+                if ( NULL == p )
+                {
+                    PutValue( ringPointer, (uint64_t) 0 );
+                    return;
+                }
+
+                size_t chars = 0;
+                while ( ( chars < MaxStringArg ) && ( 0 != p[ chars ] ) )
+                    chars++;
+
+                if ( full || ( ( len + 1 + sizeof( uint16_t ) + ( chars + 1 ) * sizeof( C ) ) > MaxRecord ) )
+                {
+                    full = true;
+                    return;
+                }
+
+                uint16_t c16 = (uint16_t) chars;
+                C zero = 0;
+                Put( &type, 1 );
+                Put( &c16, sizeof c16 );
+                Put( p, chars * sizeof( C ) );
+                Put( &zero, sizeof zero );
+            } //PutString
+        };
+
+        std::mutex ringMtx;                          // guards the list of rings and ringBytes, not the rings' contents
+        std::mutex drainMtx;                         // one consumer at a time: the flusher or a Trace that didn't fit
+        vector<shared_ptr<TraceRing>> rings;         // one per thread that has traced and whose ring isn't drained since it exited
+        atomic<bool> ringEnabled;
+        size_t ringBytes;
+        int flushMS;
+        thread flusher;
+        std::mutex flushMtx;
+        condition_variable flushCV;
+        bool stopFlusher;
+
+        static RingOwner & ThreadRing()
+        {
+            static thread_local RingOwner owner;
+            return owner;
+        } //ThreadRing
+
+        TraceRing & GetThreadRing()
+        {
+            RingOwner & owner = ThreadRing();
+
+            if ( !owner.ring )
+            {
+                // first trace on this thread; the only time the ring path takes a lock
+
+                lock_guard<mutex> lock( ringMtx );
+                owner.ring = make_shared<TraceRing>( ringBytes );
+                rings.push_back( owner.ring );
+            }
+
+            return *owner.ring;
+        } //GetThreadRing
+
+        // Marks a record holding text already formatted by Trace; only its address matters
+
+        static const char * TextFormat()
+        {
+            static const char marker = 0;
+            return &marker;
+        } //TextFormat
+
+        template <typename T> static typename enable_if<is_integral<T>::value || is_enum<T>::value>::type PutArg( RecordBuilder & b, T v )
+        {
+            if ( sizeof( T ) <= sizeof( uint32_t ) )
+                b.PutValue( ringInt32, (uint32_t) v );
+            else
+                b.PutValue( ringInt64, (uint64_t) v );
+        } //PutArg
+
+        template <typename T> static typename enable_if<is_floating_point<T>::value>::type PutArg( RecordBuilder & b, T v ) { b.PutValue( ringDouble, (double) v ); }
+        template <typename T> static void PutArg( RecordBuilder & b, T * p ) { b.PutValue( ringPointer, (uint64_t) (uintptr_t) p ); }
+        static void PutArg( RecordBuilder & b, const char * p ) { b.PutString( ringString, p ); }
+        static void PutArg( RecordBuilder & b, char * p ) { b.PutString( ringString, p ); }
+        static void PutArg( RecordBuilder & b, const wchar_t * p ) { b.PutString( ringWideString, p ); }
+        static void PutArg( RecordBuilder & b, wchar_t * p ) { b.PutString( ringWideString, p ); }
+
+        // data starts with room for the header. Returns false if the ring is full and the record was dropped.
+
+        bool WriteRecord( TraceRing & ring, uint8_t * data, size_t len, const char * format )
+        {
+            size_t cap = ring.buffer.size();
+            RecordHeader rh = { 0, (uint32_t) ( len - sizeof rh ), (uint64_t) std::chrono::steady_clock::now().time_since_epoch().count(), format };
+            rh.size = (uint32_t) round_up( len, (size_t) 8 );
+            memcpy( data, &rh, sizeof rh );
+
+            size_t h = ring.head.load( memory_order_relaxed );
+            size_t t = ring.tail.load( memory_order_acquire );
+            size_t offset = h & ( cap - 1 );
+            size_t toEnd = cap - offset;
+            size_t filler = ( rh.size > toEnd ) ? toEnd : 0; // records never wrap, so the flusher can read them in place
+
+            if ( ( h + filler + rh.size - t ) > cap )
+                return false;
+
+            if ( 0 != filler )
+            {
+                if ( filler >= sizeof( RecordHeader ) )
+                {
+                    RecordHeader fill = { (uint32_t) filler, 0, 0, NULL };
+                    memcpy( ring.buffer.data() + offset, &fill, sizeof fill );
+                }
+
+                offset = 0;
+            }
+
+            memcpy( ring.buffer.data() + offset, data, len );
+            ring.head.store( h + filler + rh.size, memory_order_release );
+            return true;
+        } //WriteRecord
+
+        // Format on the calling thread and queue the text behind this thread's TraceFast records.
+        // Returns false if the line is too long or the ring is full; the caller then writes it directly.
+
+        bool QueueText( bool pid, const char * format, va_list args )
+        {
+            uint8_t data[ MaxRecord ];
+            char * ptext = (char *) data + sizeof( RecordHeader );
+            size_t room = MaxRecord - sizeof( RecordHeader );
+            int len = 0;
+
+            if ( pid )
+                len = snprintf( ptext, room, "PID %6u -- ", PID() );
+
+            int textLen = vsnprintf( ptext + len, room - len, format, args );
+            if ( textLen < 0 || (size_t) ( len + textLen ) >= room )
+                return false;
+
+            return WriteRecord( GetThreadRing(), data, sizeof( RecordHeader ) + len + textLen, TextFormat() );
+        } //QueueText
+
+        // Trace's path while the ring is enabled. Returns true if the line was queued; otherwise everything
+        // queued so far has been written so the caller's direct write lands after it.
+
+        bool TryQueueText( bool pid, const char * format, va_list args )
+        {
+            if ( !ringEnabled.load( memory_order_relaxed ) )
+                return false;
+
+            if ( QueueText( pid, format, args ) )
+                return true;
+
+            DrainRings();
+            return false;
+        } //TryQueueText
+
+        static bool IsWideSpec( const string & spec )
+        {
+            char c = spec.back();
+            return ( 'S' == c ) || ( string::npos != spec.find_first_of( "wl" ) );
+        } //IsWideSpec
+
+        static bool Is64Spec( const string & spec )
+        {
+            if ( ( string::npos != spec.find( "ll" ) ) || ( string::npos != spec.find( "I64" ) ) ||
+                 ( string::npos != spec.find_first_of( "zjt" ) ) )
+                return true;
+
+            return ( 8 == sizeof( long ) ) && ( string::npos != spec.find( 'l' ) );
+        } //Is64Spec
+
+        // Expand one record the way vfprintf would have, one conversion at a time
+
+        static void FormatRecord( const char * format, const uint8_t * args, const uint8_t * argsEnd, string & out )
+        {
+            char buf[ 1024 ];
+            const char * p = format;
+
+            while ( 0 != *p )
+            {
+                if ( '%' != *p )
+                {
+                    out += *p++;
+                    continue;
+                }
+
+                const char * start = p++;
+                while ( ( 0 != *p ) && ( 0 != strchr( "-+ #0123456789.hlLzjtIw", *p ) ) )
+                    p++;
+
+                if ( 0 == *p || '*' == *p )
+                {
+                    out += start;
+                    return;
+                }
+
+                char c = *p++;
+                string spec( start, p - start );
+
+                if ( '%' == c )
+                {
+                    out += '%';
+                    continue;
+                }
+
+                if ( args >= argsEnd )
+                {
+                    out += spec; // the record ran out of room for this argument
+                    continue;
+                }
+
+                RingArgType type = (RingArgType) *args++;
+                bool isString = ( 's' == c ) || ( 'S' == c );
+                buf[ 0 ] = 0;
+
+                if ( ringString == type || ringWideString == type )
+                {
+                    uint16_t chars;
+                    memcpy( &chars, args, sizeof chars );
+                    args += sizeof chars;
+
+                    if ( ringString == type )
+                    {
+                        const char * pc = (const char *) args;
+                        if ( isString && !IsWideSpec( spec ) )
+                            snprintf( buf, sizeof buf, spec.c_str(), pc );
+                        else
+                            out += pc;
+                        args += chars + 1;
+                    }
+                    else
+                    {
+                        const wchar_t * pwc = (const wchar_t *) args;
+                        if ( isString && IsWideSpec( spec ) )
+                            snprintf( buf, sizeof buf, spec.c_str(), pwc );
+                        else
+                            for ( uint16_t i = 0; i < chars; i++ )
+                                out += (char) pwc[ i ];
+                        args += ( chars + 1 ) * sizeof( wchar_t );
+                    }
+                }
+                else
+                {
+                    uint64_t v = 0;
+                    size_t cb = ( ringInt32 == type ) ? sizeof( uint32_t ) : sizeof( uint64_t );
+                    memcpy( &v, args, cb );
+                    args += cb;
+
+                    double d = 0.0;
+                    if ( ringDouble == type )
+                        memcpy( &d, &v, sizeof d );
+                    else if ( ringInt32 == type )
+                        v = (uint64_t) (int64_t) (int32_t) v; // sign-extend in case a 64-bit spec asks for it
+
+                    if ( isString )
+                        out += "(?)";                     // a number where a string belongs; don't dereference it
+                    else if ( 0 != strchr( "fFeEgGaA", c ) )
+                        snprintf( buf, sizeof buf, spec.c_str(), ( ringDouble == type ) ? d : (double) (int64_t) v );
+                    else if ( ringDouble == type )
+                        snprintf( buf, sizeof buf, spec.c_str(), (long long) d );
+                    else if ( 'p' == c )
+                        snprintf( buf, sizeof buf, spec.c_str(), (void *) (uintptr_t) v );
+                    else if ( Is64Spec( spec ) )
+                        snprintf( buf, sizeof buf, spec.c_str(), (unsigned long long) v );
+                    else
+                        snprintf( buf, sizeof buf, spec.c_str(), (unsigned) v );
+                }
+
+                out += buf;
+            }
+        } //FormatRecord
+
+        // Move everything in the rings to the file, oldest first
+
+        void DrainRings()
+        {
+            lock_guard<mutex> drainLock( drainMtx );
+
+            vector<uint8_t> batch;
+            vector<pair<uint64_t, size_t>> order; // ticks, offset in batch
+            size_t dropped = 0;
+
+            {
+                lock_guard<mutex> lock( ringMtx );
+
+                for ( size_t r = 0; r < rings.size(); r++ )
+                {
+                    TraceRing & ring = * rings[ r ];
+                    size_t cap = ring.buffer.size();
+                    size_t t = ring.tail.load( memory_order_relaxed );
+                    size_t h = ring.head.load( memory_order_acquire );
+
+                    while ( t < h )
+                    {
+                        size_t offset = t & ( cap - 1 );
+
+                        // too little room at the end for even a header means the producer skipped it
+
+                        if ( ( cap - offset ) < sizeof( RecordHeader ) )
+                        {
+                            t += cap - offset;
+                            continue;
+                        }
+
+                        const uint8_t * prec = ring.buffer.data() + offset;
+                        RecordHeader rh;
+                        memcpy( &rh, prec, sizeof rh );
+
+                        if ( NULL != rh.format )
+                        {
+                            order.push_back( make_pair( rh.ticks, batch.size() ) );
+                            batch.insert( batch.end(), prec, prec + sizeof rh + rh.argBytes );
+                        }
+
+                        t += rh.size;
+                    }
+
+                    ring.tail.store( t, memory_order_release );
+                    dropped += ring.dropped.exchange( 0, memory_order_relaxed );
+                }
+
+                // Free the rings of threads that have exited, once they're empty. retired is read first so
+                // head includes everything the thread wrote; a ring that got more since the loop above waits.
+
+                rings.erase( remove_if( rings.begin(), rings.end(), [] ( const shared_ptr<TraceRing> & p )
+                {
+                    return p->retired.load( memory_order_acquire ) && ( p->tail.load( memory_order_relaxed ) == p->head.load( memory_order_acquire ) );
+                } ), rings.end() );
+            }
+
+            if ( 0 == order.size() && 0 == dropped )
+                return;
+
+            sort( order.begin(), order.end() );
+
+            lock_guard<mutex> lock( mtx );
+
+            if ( NULL == fp )
+                return;
+
+            string line;
+
+            for ( size_t i = 0; i < order.size(); i++ )
+            {
+                RecordHeader rh;
+                const uint8_t * prec = batch.data() + order[ i ].second;
+                memcpy( &rh, prec, sizeof rh );
+
+                if ( TextFormat() == rh.format )
+                {
+                    fwrite( prec + sizeof rh, 1, rh.argBytes, fp );
+                    continue;
+                }
+
+                line.clear();
+                FormatRecord( rh.format, prec + sizeof rh, prec + sizeof rh + rh.argBytes, line );
+                if ( !quiet )
+                    fprintf( fp, "PID %6u -- ", PID() );
+                fputs( line.c_str(), fp );
+            }
+
+            if ( 0 != dropped )
+                fprintf( fp, "PID %6u -- tracer dropped %zu records because a ring buffer was full\n", PID(), dropped );
+
+            if ( flush )
+                fflush( fp );
+        } //DrainRings
+
+        void FlusherLoop()
+        {
+            unique_lock<mutex> lock( flushMtx );
+
+            while ( !stopFlusher )
+            {
+                flushCV.wait_for( lock, std::chrono::milliseconds( flushMS ) );
+                lock.unlock();
+                DrainRings();
+                lock.lock();
+            }
+        } //FlusherLoop
+#endif
+
+        static unsigned PID()
+        {
+#ifdef _WIN32
+            return (unsigned) _getpid();
+#else
+            return (unsigned) getpid();
+#endif
+        } //PID
+
         static char * appendHexNibble( char * p, uint8_t val )
         {
             *p++ = ( val <= 9 ) ? val + '0' : val - 10 + 'a';
@@ -122,7 +612,11 @@ class CDJLTrace
         } //ShowBinaryData
 
     public:
+#ifndef WATCOM
+        CDJLTrace() : fp( NULL ), quiet( false ), flush( true ), ringEnabled( false ), ringBytes( 0 ), flushMS( 0 ), stopFlusher( false ) {}
+#else
         CDJLTrace() : fp( NULL ), quiet( false ), flush( true ) {}
+#endif
 
         bool Enable( bool enable, const wchar_t * pcLogFile = NULL, bool destroyContents = false )
         {
@@ -180,6 +674,10 @@ class CDJLTrace
 
         void Shutdown()
         {
+#ifndef WATCOM
+            EnableBinaryRing( false );
+#endif
+
             if ( NULL != fp )
             {
                 fflush( fp );
@@ -201,16 +699,89 @@ class CDJLTrace
 
         void Flush() { if ( 0 != fp ) fflush( fp ); }
 
+#ifndef WATCOM
+        // Route TraceFast through per-thread rings and a flusher thread instead of formatting in place.
+        // ringSize:   bytes per thread, rounded up to a power of 2. Applies to threads that trace after this call.
+        // flushEvery: milliseconds between flushes
+
+        void EnableBinaryRing( bool enable, size_t ringSize = 64 * 1024, int flushEvery = 100 )
+        {
+            if ( flusher.joinable() )
+            {
+                {
+                    lock_guard<mutex> lock( flushMtx );
+                    stopFlusher = true;
+                }
+
+                flushCV.notify_one();
+                flusher.join();
+            }
+
+            ringEnabled = false;
+            DrainRings();
+
+            if ( enable && ( NULL != fp ) )
+            {
+                {
+                    lock_guard<mutex> lock( ringMtx );
+                    ringBytes = 1;
+                    while ( ringBytes < get_max( ringSize, 2 * MaxRecord ) )
+                        ringBytes <<= 1;
+                }
+
+                flushMS = get_max( 1, flushEvery );
+                stopFlusher = false;
+                flusher = thread( &CDJLTrace::FlusherLoop, this );
+                ringEnabled = true;
+            }
+        } //EnableBinaryRing
+
+        // Rings currently allocated: one per thread that has traced, until the flush after it exits
+
+        size_t RingCount()
+        {
+            lock_guard<mutex> lock( ringMtx );
+            return rings.size();
+        } //RingCount
+
+        template <int level, typename... Args> void TraceFast( const char * format, Args... args )
+        {
+            if ( level > DJL_TRACE_LEVEL || NULL == fp )
+                return;
+
+            if ( !ringEnabled.load( memory_order_relaxed ) )
+            {
+                Trace( format, args... );
+                return;
+            }
+
+            TraceRing & ring = GetThreadRing();
+            RecordBuilder b;
+            int expand[] = { 0, ( PutArg( b, args ), 0 )... };
+            (void) expand;
+
+            if ( !WriteRecord( ring, b.data, b.len, format ) )
+                ring.dropped.fetch_add( 1, memory_order_relaxed );
+        } //TraceFast
+#endif
+
         void Trace( const char * format, ... )
         {
             if ( NULL != fp )
             {
+                va_list args;
+                va_start( args, format );
+
 #ifndef WATCOM
+                bool queued = TryQueueText( !quiet, format, args );
+                va_end( args );
+                if ( queued )
+                    return;
+
+                va_start( args, format );
                 lock_guard<mutex> lock( mtx );
 #endif
 
-                va_list args;
-                va_start( args, format );
                 if ( !quiet )
                     fprintf( fp, "PID %6u -- ",
 #ifdef _WIN32
@@ -231,11 +802,18 @@ class CDJLTrace
         {
             if ( NULL != fp )
             {
+                va_list args;
+                va_start( args, format );
+
 #ifndef WATCOM
+                bool queued = TryQueueText( false, format, args );
+                va_end( args );
+                if ( queued )
+                    return;
+
+                va_start( args, format );
                 lock_guard<mutex> lock( mtx );
 #endif
-                va_list args;
-                va_start( args, format );
                 vfprintf( fp, format, args );
                 va_end( args );
                 if ( flush )
@@ -248,12 +826,19 @@ class CDJLTrace
             #ifdef DEBUG
             if ( NULL != fp && condition )
             {
+                va_list args;
+                va_start( args, format );
+
 #ifndef WATCOM
+                bool queued = TryQueueText( !quiet, format, args );
+                va_end( args );
+                if ( queued )
+                    return;
+
+                va_start( args, format );
                 lock_guard<mutex> lock( mtx );
 #endif
 
-                va_list args;
-                va_start( args, format );
                 if ( !quiet )
                     fprintf( fp, "PID %6u -- ",
 #ifdef _WIN32
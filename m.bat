@@ -4,4 +4,6 @@ del photoss.pdb
 rc photoss.rc
 cl /nologo photoss.cxx /I.\ /Ox /Qpar /O2 /Oi /Ob2 /EHac /Zi /Gy /D_AMD64_ /link ntdll.lib user32.lib gdi32.lib photoss.res /OPT:REF /subsystem:windows
 
-
+del test\metaedittest.exe
+cl /nologo test\metaedittest.cxx /I.\ /Ox /EHac /Zi /D_AMD64_ /Fetest\metaedittest.exe /Fotest\ /Fdtest\ /link /OPT:REF
+test\metaedittest.exe
@@ -21,6 +21,9 @@
 
 #include <mutex>
 #include <chrono>
+#include <thread>
+#include <memory>
+#include <condition_variable>
 
 using namespace std;
 using namespace Gdiplus;
@@ -33,7 +36,13 @@ using namespace std::chrono;
 #include <djlenum.hxx>
 #include <djl_strm.hxx>
 #include <djlimagedata.hxx>
+#include <djl_bufpool.hxx>
 #include <djl_wic2gdi.hxx>
+#include <djl_fb.hxx>
+#include <djl_gdiframe.hxx>
+#include <djl_blend.hxx>
+#include <djl_filecache.hxx>
+#include <djl_colorsig.hxx>
 
 #include "photoss.h"
 
@@ -49,11 +58,30 @@ using namespace std::chrono;
 
 #define TIMER_ID_DELAY 1
 #define TIMER_ID_BLANK 2
+#define TIMER_ID_CLOCK 3
+#define TIMER_ID_TRANSITION 4
+#define CLOCK_POLL_MS 2000
+#define TRANSITION_FRAME_MS USER_TIMER_MINIMUM   // as fast as WM_TIMER goes; frames are placed by elapsed time, not tick count
+#define TRANSITION_FADE_MS 800
+#define TRANSITION_KENBURNS_MS 1500
+#define KENBURNS_START_ZOOM 1.08
+#define DECODE_BUDGET_MS 2000       // files slower than this to decode are skipped and demoted to the end of future playlists
+#define MAX_ABANDONED_DECODES 2     // slow decodes left running in the background; past this, wait for the next tick
+#define SHUTDOWN_WAIT_MS 1000       // how long exit waits for background decodes before leaving WIC and GDI+ to them
+#define SKIP_BUDGET_MS 1500         // most time one LoadNextImage spends on files that fail before trying again next tick
+#define BAD_FILE_CACHE L"badfiles.cache"
+#define COLOR_CACHE L"colors.cache"
+#define COLOR_WARM_PERCENT 90       // share of the playlist with a cached color signature before color order is used
+#define COLOR_SAVE_MS 60000         // how often the background color job saves the cache; each save rewrites it whole
+#define OVERLAY_TIME 0
+#define OVERLAY_DATE 1
 #define REGISTRY_APP_NAME L"SOFTWARE\\photoss"
 #define REGISTRY_PHOTO_PATH L"PhotoPath"
 #define REGISTRY_PHOTO_DELAY L"PhotoDelay"
 #define REGISTRY_PHOTO_BLANK_DELAY L"BlankDelay"
 #define REGISTRY_PHOTO_SHOWCAPTUREDATE L"PhotoShowCaptureDate"
+#define REGISTRY_PHOTO_TRANSITION L"PhotoTransition"
+#define REGISTRY_PHOTO_ORDER L"PhotoOrder"
 
 CDJLTrace tracer;
 
@@ -61,7 +89,7 @@ Bitmap * g_pCurrentBitmap = NULL;
 BYTE * g_pCurrentBitmapBuffer = NULL;
 int g_currentBitmapIndex = 0;
 WCHAR g_awcPhotoPath[ MAX_PATH + 2 ] = { 0 };
-CStringArray * g_pImagePaths = NULL;
+CPathArray * g_pImagePaths = NULL;
 char g_acPhotoDateTime[ 25 ] = { 0 };
 const int g_validDelays[] = { 1, 5, 15, 30, 60, 600 };  // seconds between photo changes
 const int g_validBlanks[] = { 5, 15, 30, 60, 120 };     // minutes until the display goes blank
@@ -71,11 +99,62 @@ bool g_showCaptureDate = true;                          // also controls whether
 bool g_blankMode = false;                               // show a blank screen (plus perhaps current date)
 RECT g_AppRect;
 CImageData g_ImageData;
+CBufferPool g_FramePool( true );                        // recycles decoded frame buffers so steady state does no large allocations
 CWic2Gdi * g_pWic2Gdi = 0;
+CGdiBackBuffer g_BackBuffer;                            // persistent frame; WM_PAINT uploads only what changed
+CFrameCompositor g_Compositor;                          // tracks dirty rects and the date/time overlays on g_BackBuffer
+CGdiTextStrips * g_pTextStrips = 0;
+HFONT g_fontText = 0;
+int g_fontHeight = 30;
+
+enum TransitionMode { transitionNone, transitionFade, transitionKenBurns };
+TransitionMode g_transitionMode = transitionFade;      // registry: none, fade, or kenburns
+CFrameBuffer g_TransitionFrom;                          // the outgoing frame, overlays included
+CFrameBuffer g_TransitionTo;                            // the fully composed incoming frame
+bool g_inTransition = false;
+int g_transitionMS = 0;
+int g_transitionFrames = 0;
+double g_transitionFocusX = 0.5;                        // where the Ken Burns zoom settles, as a fraction of the frame
+double g_transitionFocusY = 0.5;
+high_resolution_clock::time_point g_transitionStart;
+
+enum BadFileReason { badDecodeFailed = 1, badEmptyImage = 2, badSlowDecode = 3 };
+CFileCache g_BadFiles;                                  // files that failed or were slow to decode, persisted across sessions
+
+// Decodes run on worker threads so the UI thread can give up on a slow one. WIC can't be interrupted,
+// so a decode that's given up on keeps running in the background and its result is thrown away.
+
+struct DecodeJob
+{
+    wstring path;
+    int targetW;
+    int targetH;
+    Bitmap * pBitmap;
+    BYTE * pBuffer;
+    HRESULT hr;
+    bool done;
+    bool abandoned;
+};
+
+struct ColorJob
+{
+    vector<CColorSignature::FileKey> files;             // a copy; the playlist changes while the job runs
+    CFileCache cache;                                   // owned by the job's thread once it starts
+    atomic<bool> stop;
+};
+
+std::mutex g_workerMtx;                                 // guards the DecodeJobs and the counts below
+condition_variable g_workerDone;
+int g_workersRunning = 0;                               // decode and color threads still running, abandoned ones included
+int g_workersAbandoned = 0;
+bool g_workersOrphaned = false;                         // set at exit if workers are still running; they then touch nothing
+bool g_colorOrder = false;                              // registry: random or color
+shared_ptr<ColorJob> g_pColorJob;                       // signatures for files not yet in the color cache
 
 long long timeCreate = 0;
 long long timeDraw = 0;
 long long timeBLT = 0;
+long long timeTransition = 0;
 
 class StartupDPIAwareness
 {
@@ -194,26 +273,254 @@ void LoadPhotoPath()
 
         tracer.Trace( "blankdelay found: %d, final value %d\n", found, blankDelay );
     }
+
+    WCHAR awcTransition[ 20 ];
+    awcTransition[ 0 ] = 0;
+    ok = CDJLRegistry::readStringFromRegistry( HKEY_CURRENT_USER, REGISTRY_APP_NAME, REGISTRY_PHOTO_TRANSITION, awcTransition, sizeof( awcTransition ) );
+
+    if ( ok )
+    {
+        if ( !wcsicmp( awcTransition, L"none" ) )
+            g_transitionMode = transitionNone;
+        else if ( !wcsicmp( awcTransition, L"kenburns" ) )
+            g_transitionMode = transitionKenBurns;
+        else
+            g_transitionMode = transitionFade;
+
+        tracer.Trace( "read transition %ws from registry, mode %d\n", awcTransition, g_transitionMode );
+    }
+
+    WCHAR awcOrder[ 20 ];
+    awcOrder[ 0 ] = 0;
+    ok = CDJLRegistry::readStringFromRegistry( HKEY_CURRENT_USER, REGISTRY_APP_NAME, REGISTRY_PHOTO_ORDER, awcOrder, sizeof( awcOrder ) );
+
+    if ( ok )
+        g_colorOrder = !wcsicmp( awcOrder, L"color" );
 } //LoadPhotoPath
 
+bool GetAppDataPath( const WCHAR * pwcName, WCHAR * pwcPath, size_t cchPath )
+{
+    // %LOCALAPPDATA%\photoss\name; the folder is created if needed
+
+    PWSTR path = NULL;
+    HRESULT hr = SHGetKnownFolderPath( FOLDERID_LocalAppData, 0, NULL, &path );
+    if ( S_OK != hr )
+        return false;
+
+    int len = swprintf_s( pwcPath, cchPath, L"%ws\\photoss", path );
+    CoTaskMemFree( path );
+
+    if ( len <= 0 )
+        return false;
+
+    CreateDirectory( pwcPath, NULL );
+
+    return ( swprintf_s( pwcPath + len, cchPath - len, L"\\%ws", pwcName ) > 0 );
+} //GetAppDataPath
+
+void StartColorFill( shared_ptr<ColorJob> job )
+{
+    // Decoding a big library for the first time takes minutes, so it's done in the background and saved as it
+    // goes. This session stays in whatever order it started with; later ones get color order once it's done.
+
+    job->stop = false;
+
+    {
+        lock_guard<mutex> lock( g_workerMtx );
+        g_workersRunning++;
+    }
+
+    std::thread( [job] ()
+    {
+        CoInitializeEx( NULL, COINIT_MULTITHREADED );
+        CColorSignature::Fill( job->files, job->cache, job->stop, COLOR_SAVE_MS );
+        CoUninitialize();
+
+        lock_guard<mutex> lock( g_workerMtx );
+        g_workersRunning--;
+        g_workerDone.notify_all();
+    } ).detach();
+} //StartColorFill
+
+void OrderPlaylist()
+{
+    // Drop files known not to decode before they cost anything, order the rest, then push slow ones
+    // behind everything else. The demoted files keep the chosen order among themselves.
+
+    size_t removed = g_pImagePaths->DeleteIf( [] ( CPathArray::PathItem & pi )
+    {
+        ULONG reason = 0;
+        return g_BadFiles.Lookup( pi.pwcPath, pi.ullSize, pi.ftLastWrite, reason ) && ( badSlowDecode != reason );
+    } );
+
+    bool colorOrdered = false;
+
+    if ( g_colorOrder )
+    {
+        // Sort by color only once most files have a cached signature; files without one sort last.
+        // Signatures for the rest are computed in the background for the next run.
+
+        shared_ptr<ColorJob> job = make_shared<ColorJob>();
+        WCHAR awcCache[ MAX_PATH ];
+
+        if ( GetAppDataPath( COLOR_CACHE, awcCache, _countof( awcCache ) ) )
+        {
+            job->cache.Load( awcCache );
+            size_t missing = CColorSignature::Lookup( *g_pImagePaths, job->cache, job->files );
+            tracer.Trace( "color cache has %zu entries; %zu of %zu files have no signature yet\n", job->cache.Count(), missing, g_pImagePaths->Count() );
+
+            if ( ( missing * 100 ) <= ( g_pImagePaths->Count() * ( 100 - COLOR_WARM_PERCENT ) ) )
+            {
+                // start each session at a different hue
+
+                g_pImagePaths->SortOnAttribute();
+                g_pImagePaths->RotateRandomly();
+                colorOrdered = true;
+            }
+
+            if ( 0 != missing )
+            {
+                g_pColorJob = job;
+                StartColorFill( job );
+            }
+        }
+    }
+
+    if ( !colorOrdered )
+        g_pImagePaths->Randomize();
+
+    size_t demoted = g_pImagePaths->MoveToEnd( [] ( CPathArray::PathItem & pi )
+    {
+        ULONG reason = 0;
+        return g_BadFiles.Lookup( pi.pwcPath, pi.ullSize, pi.ftLastWrite, reason ) && ( badSlowDecode == reason );
+    } );
+
+    tracer.Trace( "bad file cache has %zu entries; removed %zu files from the playlist and demoted %zu\n", g_BadFiles.Count(), removed, demoted );
+} //OrderPlaylist
+
+void RecordBadFile( BadFileReason reason, const WCHAR * pwcNote )
+{
+    CPathArray::PathItem & pi = g_pImagePaths->GetPathItem( g_currentBitmapIndex );
+    tracer.Trace( "  remembering %ws as a bad file, reason %d: %ws\n", pi.pwcPath, reason, pwcNote );
+    g_BadFiles.Set( pi.pwcPath, pi.ullSize, pi.ftLastWrite, reason, pwcNote );
+} //RecordBadFile
+
+void DropCurrentImage( bool forward )
+{
+    // Don't try the file again this session. Leave the index so the next step in the same direction
+    // lands on the dropped file's neighbor; it can be -1 until then.
+
+    g_pImagePaths->Delete( g_currentBitmapIndex );
+
+    if ( forward )
+        g_currentBitmapIndex--;
+} //DropCurrentImage
+
+Bitmap * DecodeWithBudget( const WCHAR * pwcPath, int targetW, int targetH, BYTE ** ppBuffer, HRESULT & hr, bool & timedOut )
+{
+    *ppBuffer = NULL;
+    timedOut = false;
+
+    shared_ptr<DecodeJob> job = make_shared<DecodeJob>();
+    job->path = pwcPath;
+    job->targetW = targetW;
+    job->targetH = targetH;
+    job->pBitmap = NULL;
+    job->pBuffer = NULL;
+    job->hr = E_FAIL;
+    job->done = false;
+    job->abandoned = false;
+
+    {
+        lock_guard<mutex> lock( g_workerMtx );
+        g_workersRunning++;
+    }
+
+    std::thread( [job] ()
+    {
+        CoInitializeEx( NULL, COINIT_MULTITHREADED );
+
+        BYTE * pBuffer = NULL;
+        HRESULT hrDecode = E_FAIL;
+        int availableW, availableH;
+        Bitmap * pBitmap = g_pWic2Gdi->GDIPBitmapFromWIC( (WCHAR *) job->path.c_str(), 0, &pBuffer, job->targetW, job->targetH,
+                                                          &availableW, &availableH, PixelFormat32bppRGB, &hrDecode );
+        CoUninitialize();
+
+        lock_guard<mutex> lock( g_workerMtx );
+
+        if ( !job->abandoned )
+        {
+            job->pBitmap = pBitmap;
+            job->pBuffer = pBuffer;
+            job->hr = hrDecode;
+        }
+        else
+        {
+            tracer.Trace( "abandoned decode of %ws finished, hr %#x\n", job->path.c_str(), hrDecode );
+            g_workersAbandoned--;
+
+            if ( !g_workersOrphaned )
+            {
+                delete pBitmap;
+                g_pWic2Gdi->FreeBuffer( pBuffer );
+            }
+        }
+
+        job->done = true;
+        g_workersRunning--;
+        g_workerDone.notify_all();
+    } ).detach();
+
+    unique_lock<mutex> lock( g_workerMtx );
+
+    if ( !g_workerDone.wait_for( lock, std::chrono::milliseconds( DECODE_BUDGET_MS ), [&] () { return job->done; } ) )
+    {
+        job->abandoned = true;
+        g_workersAbandoned++;
+        timedOut = true;
+        hr = E_PENDING;
+        return NULL;
+    }
+
+    *ppBuffer = job->pBuffer;
+    hr = job->hr;
+    return job->pBitmap;
+} //DecodeWithBudget
+
+bool WaitForWorkers( int ms )
+{
+    // At exit. If a decode is stuck, e.g. on a dead network share, it's left running and must not
+    // touch WIC, GDI+, or the frame pool afterwards. Returns true if no workers are running.
+
+    unique_lock<mutex> lock( g_workerMtx );
+
+    if ( g_workerDone.wait_for( lock, std::chrono::milliseconds( ms ), [] () { return 0 == g_workersRunning; } ) )
+        return true;
+
+    tracer.Trace( "%d workers still running at exit; leaving WIC and GDI+ up for them\n", g_workersRunning );
+    g_workersOrphaned = true;
+    return false;
+} //WaitForWorkers
+
 bool LoadNextImageInternal( bool forward )
 {
-    tracer.Trace( "LoadNextImage, count of images %d, current %d, forward %d\n", g_pImagePaths->Count(), g_currentBitmapIndex, forward );
+    tracer.Trace( "LoadNextImage, count of images %zu, current %d, forward %d\n", g_pImagePaths->Count(), g_currentBitmapIndex, forward );
 
     if ( 0 == g_pImagePaths->Count() )
-        return true;
+        return false;
 
     if ( forward )
     {
         g_currentBitmapIndex++;
 
-        if ( g_currentBitmapIndex >= g_pImagePaths->Count() )
+        if ( g_currentBitmapIndex >= (int) g_pImagePaths->Count() )
             g_currentBitmapIndex = 0;
     }
     else
     {
-        if ( 0 == g_currentBitmapIndex )
-            g_currentBitmapIndex = g_pImagePaths->Count() - 1;
+        if ( g_currentBitmapIndex <= 0 )
+            g_currentBitmapIndex = (int) g_pImagePaths->Count() - 1;
         else
             g_currentBitmapIndex--;
     }
@@ -240,8 +547,19 @@ bool LoadNextImageInternal( bool forward )
     //Bitmap * pBitmap = new Bitmap( g_pImagePaths->Get( g_currentBitmapIndex ), FALSE );
 
     BYTE *pBitmapBuffer = NULL;
-    int availableW, availableH;
-    Bitmap * pBitmap = g_pWic2Gdi->GDIPBitmapFromWIC( g_pImagePaths->Get( g_currentBitmapIndex ), 0, &pBitmapBuffer, targetW, targetH, &availableW, &availableH );
+    HRESULT hr = S_OK;
+    bool timedOut = false;
+    Bitmap * pBitmap = DecodeWithBudget( g_pImagePaths->Get( g_currentBitmapIndex ), targetW, targetH, &pBitmapBuffer, hr, timedOut );
+
+    if ( timedOut )
+    {
+        // Skip it this time and put it behind everything else in future playlists
+
+        WCHAR awcNote[ 60 ];
+        swprintf_s( awcNote, _countof( awcNote ), L"decode took over %d ms", DECODE_BUDGET_MS );
+        RecordBadFile( badSlowDecode, awcNote );
+        return false;
+    }
 
     if ( NULL != pBitmap )
     {
@@ -249,14 +567,24 @@ bool LoadNextImageInternal( bool forward )
         {
             tracer.Trace( "  image has w %d, h %d, so it'll be skipped\n", pBitmap->GetWidth(), pBitmap->GetHeight() );
             delete pBitmap;
-            delete pBitmapBuffer;
+            g_pWic2Gdi->FreeBuffer( pBitmapBuffer );
+            RecordBadFile( badEmptyImage, L"image has a width or height of 0" );
+            DropCurrentImage( forward );
             return false;
         }
 
+        // a file that was slow before but decoded within budget this time is forgiven
+
+        CPathArray::PathItem & pi = g_pImagePaths->GetPathItem( g_currentBitmapIndex );
+        ULONG reason = 0;
+
+        if ( g_BadFiles.Lookup( pi.pwcPath, pi.ullSize, pi.ftLastWrite, reason ) )
+            g_BadFiles.Remove( pi.pwcPath );
+
         if ( NULL != g_pCurrentBitmap )
         {
             delete g_pCurrentBitmap;
-            delete g_pCurrentBitmapBuffer;
+            g_pWic2Gdi->FreeBuffer( g_pCurrentBitmapBuffer );
         }
 
         g_pCurrentBitmap = pBitmap;
@@ -269,30 +597,59 @@ bool LoadNextImageInternal( bool forward )
         if ( g_showCaptureDate )
             g_ImageData.FindDateTime( g_pImagePaths->Get( g_currentBitmapIndex ), g_acPhotoDateTime, _countof( g_acPhotoDateTime ) );
     }
+    else if ( CFileCache::IsTransientFailure( hr ) )
+    {
+        // skip it this time, but it stays in the playlist and isn't remembered as bad
+
+        tracer.Trace( "  transient failure %#x loading the file; skipping it for now\n", hr );
+        return false;
+    }
     else
+    {
+        WCHAR awcNote[ 60 ];
+        swprintf_s( awcNote, _countof( awcNote ), L"WIC can't decode the file, hr %#x", hr );
+        RecordBadFile( badDecodeFailed, awcNote );
+        DropCurrentImage( forward );
         return false;
+    }
 
     return true;
 } //LoadNextImageInternal
 
-void LoadNextImage( bool forward = true )
+bool LoadNextImage( bool forward = true )
 {
-    // Skip over files that can't be loaded or have a 0 width or height.
+    // Skip over files that can't be loaded, are too slow, or have a 0 width or height. Files that fail for good
+    // are dropped from the playlist as they fail, so this ends even if none of the images can be loaded (e.g. all are .cr3).
+    // Don't stall the display on a long run of failures; the next tick picks up where this left off.
+    // Returns true if a new image is now current.
 
-    int start = g_currentBitmapIndex;
+    high_resolution_clock::time_point tStart = high_resolution_clock::now();
 
-    do
+    while ( 0 != g_pImagePaths->Count() )
     {
-        bool worked = LoadNextImageInternal( forward );
+        {
+            lock_guard<mutex> lock( g_workerMtx );
 
-        if ( worked )
-            return;
+            if ( g_workersAbandoned >= MAX_ABANDONED_DECODES )
+            {
+                tracer.Trace( "%d slow decodes are still running; not starting another until next time\n", g_workersAbandoned );
+                return false;
+            }
+        }
 
-        // avoid infinite loop if none of the imags can be loaded (e.g. all are .cr3)
+        if ( LoadNextImageInternal( forward ) )
+            return true;
 
-        if ( g_currentBitmapIndex == start )
-            return;
-    } while ( true );
+        long long spentMS = duration_cast<std::chrono::milliseconds>( high_resolution_clock::now() - tStart ).count();
+
+        if ( spentMS > SKIP_BUDGET_MS )
+        {
+            tracer.Trace( "spent %lld ms on files that can't be loaded; giving up until next time\n", spentMS );
+            return false;
+        }
+    }
+
+    return false;
 } //LoadNextImage
 
 void PutPathTextInClipboard( const WCHAR * pwcPath )
@@ -334,7 +691,7 @@ void CopyCommand( HWND hwnd )
 {
     tracer.Trace( "copying path into clipboard\n" );
 
-    if ( !g_blankMode && ( 0 != g_pImagePaths ) && ( 0 != g_pImagePaths->Count() ) )
+    if ( !g_blankMode && ( 0 != g_pImagePaths ) && ( g_currentBitmapIndex >= 0 ) && ( g_currentBitmapIndex < (int) g_pImagePaths->Count() ) )
     {
         if ( OpenClipboard( hwnd ) )
         {
@@ -358,6 +715,270 @@ __forceinline void WordToWC( WCHAR * pwc, WORD x )
     pwc[1] = ( x % 10 ) + L'0';
 } //WordToWC
 
+void GetPhotoRect( HWND hWnd, RECT & rect )
+{
+    GetClientRect( hWnd, &rect );
+
+    // super-minimal multi-mon support. If displays are apparently side by side, only use the left one.
+
+    if ( 0 != rect.bottom && ( (double) rect.right / (double) rect.bottom ) > 2.0 )
+        rect.right /= 2;
+} //GetPhotoRect
+
+void UpdateOverlays( HWND hWnd, bool moveClock )
+{
+    // Overlays that haven't changed cost nothing, so this is cheap to call whenever the minute might have rolled over.
+
+    static int clockRight = 0;
+    static int clockTop = 0;
+
+    RECT rect;
+    GetPhotoRect( hWnd, rect );
+
+    WCHAR awcCurrentTime[ 6 ] = { L'h', L'h', L':', L'm', L'm', 0 };
+    SYSTEMTIME lt = {};
+    GetLocalTime( &lt );
+    WordToWC( awcCurrentTime,     lt.wHour );
+    WordToWC( awcCurrentTime + 3, lt.wMinute );
+
+    if ( ( 0 != g_pCurrentBitmap ) && ( 0 != g_acPhotoDateTime[ 0 ] ) )
+    {
+        WCHAR awcDateTime[ _countof( g_acPhotoDateTime ) ];
+        size_t converted = 0;
+        mbstowcs_s( &converted, awcDateTime, _countof( awcDateTime ), g_acPhotoDateTime, _TRUNCATE );
+
+        g_Compositor.SetOverlay( OVERLAY_TIME, awcCurrentTime, rect.right, rect.top );
+        g_Compositor.SetOverlay( OVERLAY_DATE, awcDateTime, rect.right, rect.bottom - g_fontHeight );
+    }
+    else if ( g_blankMode && g_showCaptureDate )
+    {
+        // in blank mode; show the current time in a random location.
+
+        if ( moveClock || ( 0 == clockRight ) )
+        {
+            int effectiveWidth = get_max( 1, (int) ( rect.right - rect.left ) - g_fontHeight * 10 );
+            int effectiveHeight = get_max( 1, (int) ( rect.bottom - rect.top ) - g_fontHeight );
+            clockRight = rect.right - ( rand() % effectiveWidth );
+            clockTop = rect.top + ( rand() % effectiveHeight );
+        }
+
+        g_Compositor.HideOverlay( OVERLAY_DATE );
+        g_Compositor.SetOverlay( OVERLAY_TIME, awcCurrentTime, clockRight, clockTop );
+    }
+    else
+    {
+        g_Compositor.HideOverlay( OVERLAY_TIME );
+        g_Compositor.HideOverlay( OVERLAY_DATE );
+    }
+
+    vector<FBRect> dirty;
+    g_Compositor.TakeDirty( dirty );
+    CGdiBackBuffer::Invalidate( hWnd, dirty );
+} //UpdateOverlays
+
+void ComposeFrame( HWND hWnd )
+{
+    // Scale the current photo into the back buffer once per image. Clock updates and
+    // repaints after that only touch the overlays.
+
+    RECT rectClient;
+    GetClientRect( hWnd, &rectClient );
+
+    if ( 0 == rectClient.right || 0 == rectClient.bottom )
+        return;
+
+    if ( rectClient.right != g_BackBuffer.Width() || rectClient.bottom != g_BackBuffer.Height() )
+    {
+        high_resolution_clock::time_point tA = high_resolution_clock::now();
+        HDC hdc = GetDC( hWnd );
+        bool ok = g_BackBuffer.Create( hdc, rectClient.right, rectClient.bottom );
+        ReleaseDC( hWnd, hdc );
+        high_resolution_clock::time_point tB = high_resolution_clock::now();
+        timeCreate += duration_cast<std::chrono::nanoseconds>( tB - tA ).count();
+
+        if ( !ok )
+            return;
+
+        g_Compositor.Attach( g_BackBuffer.Bits(), g_BackBuffer.Width(), g_BackBuffer.Height(), g_BackBuffer.Width() );
+    }
+
+    RECT rect;
+    GetPhotoRect( hWnd, rect );
+    double arDisplay = (double) rect.right / (double) rect.bottom;
+
+    g_Compositor.BeginFrame( 0 );
+
+    if ( 0 != g_pCurrentBitmap )
+    {
+        int bw = g_pCurrentBitmap->GetWidth();
+        int bh = g_pCurrentBitmap->GetHeight();
+
+        tracer.Trace( "composing frame. image w %d, h %d\n", bw, bh );
+
+        if ( 0 != bw && 0 != bh )
+        {
+            double arBitmap = (double) bw / (double) bh;
+
+            int toLeft = 0;
+            int toTop = 0;
+            int targetWidth = rect.right;
+            int targetHeight = rect.bottom;
+
+            if ( arBitmap > arDisplay )
+            {
+                // bitmap is wider than the screen
+
+                double ratio = (double) rect.right / (double) bw;
+                targetHeight = (int) ( ratio * (double) bh );
+                toTop = ( rect.bottom - targetHeight ) / 2;
+            }
+            else
+            {
+                // bitmap is more narrow than the screen
+
+                double ratio = (double) rect.bottom / (double) bh;
+                targetWidth = (int) ( ratio * (double) bw );
+                toLeft = ( rect.right - targetWidth ) / 2;
+            }
+
+            tracer.Trace( "arBitmap %lf, arScreen %lf, targetHeight %d, targetWidth %d, toLeft %d, toTop %d\n",
+                          arBitmap, arDisplay, targetHeight, targetWidth, toLeft, toTop );
+
+            // DrawImage into the display is visibly slow -- you can see drawing from top to bottom.
+            // Instead, stretch the image into the persistent back buffer and upload that in WM_PAINT.
+
+            unique_ptr<Graphics> gDCBack( Graphics::FromHDC( g_BackBuffer.DC() ) );
+            gDCBack->SetCompositingMode( CompositingMode::CompositingModeSourceCopy );
+
+            gDCBack->SetCompositingQuality( CompositingQuality::CompositingQualityHighQuality );
+            gDCBack->SetInterpolationMode( InterpolationMode::InterpolationModeHighQualityBicubic );
+            gDCBack->SetPixelOffsetMode( PixelOffsetMode::PixelOffsetModeHighQuality );
+
+            // No need to SetWrapMode( Tile ) since only one image is being drawn on the Graphics object.
+
+            Rect rectTo( toLeft, toTop, targetWidth, targetHeight );
+            high_resolution_clock::time_point tC = high_resolution_clock::now();
+            gDCBack->DrawImage( g_pCurrentBitmap, rectTo, 0, 0, bw, bh, UnitPixel, NULL, NULL );
+            gDCBack.reset();
+            GdiFlush(); // the compositor is about to read and write the same DIB bits directly
+            high_resolution_clock::time_point tD = high_resolution_clock::now();
+            timeDraw += duration_cast<std::chrono::nanoseconds>( tD - tC ).count();
+        }
+    }
+
+    g_Compositor.EndFrame();
+    UpdateOverlays( hWnd, true );
+} //ComposeFrame
+
+void CaptureBackBuffer( CFrameBuffer & fb )
+{
+    // The transition frames are allocated once and reused, so steady state does no large allocations
+
+    if ( fb.Width() != g_BackBuffer.Width() || fb.Height() != g_BackBuffer.Height() )
+        fb.Allocate( g_BackBuffer.Width(), g_BackBuffer.Height() );
+
+    GdiFlush();
+    fb.Blit( 0, 0, g_Compositor.Frame() );
+} //CaptureBackBuffer
+
+void RenderTransition( HWND hWnd )
+{
+    // Progress comes from the clock rather than from counting ticks, so late or coalesced
+    // WM_TIMER messages make the transition choppier but never longer.
+
+    high_resolution_clock::time_point tA = high_resolution_clock::now();
+    double elapsed = (double) duration_cast<std::chrono::milliseconds>( tA - g_transitionStart ).count();
+    double t = get_min( 1.0, elapsed / (double) g_transitionMS );
+    double eased = t * t * ( 3.0 - 2.0 * t ); // smoothstep, so the fade eases in and out
+    CFrameBuffer & back = g_Compositor.Frame();
+
+    GdiFlush(); // the kernels write the DIB bits directly
+
+    if ( t >= 1.0 )
+    {
+        KillTimer( hWnd, TIMER_ID_TRANSITION );
+        g_inTransition = false;
+        back.Blit( 0, 0, g_TransitionTo );
+
+        tracer.Trace( "transition done: %d frames, average %lld ns per frame\n", g_transitionFrames,
+                      timeTransition / get_max( 1, g_transitionFrames ) );
+
+        // the clock may have rolled over while it was held still
+
+        UpdateOverlays( hWnd, false );
+    }
+    else
+    {
+        uint32_t alpha = (uint32_t) ( eased * 256.0 + 0.5 );
+
+        if ( transitionKenBurns == g_transitionMode )
+        {
+            // the incoming photo settles from a slight zoom to exactly how it's composed, then fades over the old one
+
+            double zoom = 1.0 + ( KENBURNS_START_ZOOM - 1.0 ) * ( 1.0 - eased );
+            CBlend::SampleAffine( back, g_TransitionTo, CBlend::ZoomAbout( back.Width(), back.Height(), zoom, g_transitionFocusX, g_transitionFocusY ) );
+            CBlend::BlendFrames( back, g_TransitionFrom, back, alpha );
+        }
+        else
+            CBlend::BlendFrames( back, g_TransitionFrom, g_TransitionTo, alpha );
+
+        g_transitionFrames++;
+        timeTransition += duration_cast<std::chrono::nanoseconds>( high_resolution_clock::now() - tA ).count();
+    }
+
+    InvalidateRect( hWnd, NULL, FALSE );
+} //RenderTransition
+
+void EndTransition( HWND hWnd )
+{
+    if ( g_inTransition )
+    {
+        g_transitionStart = high_resolution_clock::now() - std::chrono::milliseconds( g_transitionMS );
+        RenderTransition( hWnd );
+    }
+} //EndTransition
+
+void ShowNextImage( HWND hWnd )
+{
+    EndTransition( hWnd );
+
+    bool animate = ( transitionNone != g_transitionMode ) && g_BackBuffer.Ok();
+
+    // nothing to show if no file loaded before the skip budget ran out; keep the current photo
+
+    if ( !LoadNextImage( true ) )
+        return;
+
+    if ( animate )
+        CaptureBackBuffer( g_TransitionFrom );
+
+    ComposeFrame( hWnd );
+
+    // a resized window means the old frame doesn't line up with the new one; just cut
+
+    if ( !animate || !g_BackBuffer.Ok() ||
+         g_TransitionFrom.Width() != g_BackBuffer.Width() || g_TransitionFrom.Height() != g_BackBuffer.Height() )
+        return;
+
+    CaptureBackBuffer( g_TransitionTo );
+
+    // don't let the transition eat most of a short photo delay
+
+    g_transitionMS = ( transitionKenBurns == g_transitionMode ) ? TRANSITION_KENBURNS_MS : TRANSITION_FADE_MS;
+    g_transitionMS = get_min( g_transitionMS, 1000 * photoDelay / 2 );
+    g_transitionFocusX = 0.25 + 0.5 * ( (double) rand() / (double) RAND_MAX );
+    g_transitionFocusY = 0.25 + 0.5 * ( (double) rand() / (double) RAND_MAX );
+    g_transitionFrames = 0;
+    timeTransition = 0;
+    g_transitionStart = high_resolution_clock::now();
+    g_inTransition = true;
+
+    // Put the first frame (the old photo) back right away so a WM_PAINT before the first tick doesn't flash the new one
+
+    RenderTransition( hWnd );
+    SetTimer( hWnd, TIMER_ID_TRANSITION, TRANSITION_FRAME_MS, NULL );
+} //ShowNextImage
+
 // else the header redefines as W version but the lib links to the non-W version.
 #undef ScreenSaverProc
 
@@ -366,25 +987,24 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
     static bool firstEraseBackground = true;
     static bool iterationPaused = false;
     static ULONG_PTR gdiplusToken = 0;
-    static HBRUSH brushBlack = 0;
-    static HFONT fontText = 0;
-    static int fontHeight = 30;
 
-    tracer.Trace( "message %#x, wparam %#x\n", message, wParam );
+    tracer.TraceFast<traceVerbose>( "message %#x, wparam %#x\n", message, wParam );
 
     switch ( message )
     {
         case WM_CREATE:
         {
             tracer.Enable( false, L"d:\\photoss.txt" );
-
-            brushBlack = CreateSolidBrush( RGB( 0, 0, 0 ) );
+            tracer.EnableBinaryRing( true ); // every window message is traced; keep that off the UI thread's timings
 
             GetClientRect( hWnd, &g_AppRect );
-            fontHeight = g_AppRect.bottom / 50;
-            tracer.Trace( "font height: %d\n", fontHeight );
-            fontText = CreateFont( fontHeight, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_OUTLINE_PRECIS,
-                                   CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY, VARIABLE_PITCH, L"Tahoma" );
+            g_fontHeight = g_AppRect.bottom / 50;
+            tracer.Trace( "font height: %d\n", g_fontHeight );
+            g_fontText = CreateFont( g_fontHeight, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_OUTLINE_PRECIS,
+                                     CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY, VARIABLE_PITCH, L"Tahoma" );
+
+            g_pTextStrips = new CGdiTextStrips( g_fontText, RGB( 140, 140, 100 ), RGB( 0, 0, 0 ) );
+            g_Compositor.SetStripRenderer( [] ( const wstring & text, CFrameBuffer & strip ) { return g_pTextStrips->Render( text, strip ); } );
 
             LoadPhotoPath();
             tracer.Trace( "wm_create, g_awcPhotoPath %ws\n", g_awcPhotoPath );
@@ -393,7 +1013,7 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
             if ( FAILED( hr ) )
                 return 0;
         
-            g_pWic2Gdi = new CWic2Gdi();
+            g_pWic2Gdi = new CWic2Gdi( &g_FramePool );
             if ( !g_pWic2Gdi->Ok() )
                 return 0;
 
@@ -402,17 +1022,23 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
             if ( Status::Ok != gdiStatus )
                 return 0;
 
-            g_pImagePaths = new CStringArray();
+            g_pImagePaths = new CPathArray();
             CEnumFolder enumFolder( true, g_pImagePaths, (WCHAR **) imageExtensions, _countof( imageExtensions ) );
             enumFolder.Enumerate( g_awcPhotoPath, L"*" );
 
-            tracer.Trace( "found %d files\n", g_pImagePaths->Count() );
+            tracer.Trace( "found %zu files\n", g_pImagePaths->Count() );
+
+            WCHAR awcCache[ MAX_PATH ];
+            if ( GetAppDataPath( BAD_FILE_CACHE, awcCache, _countof( awcCache ) ) )
+                g_BadFiles.Load( awcCache );
 
-            g_pImagePaths->Randomize();
+            OrderPlaylist();
             LoadNextImage( true );
+            g_BadFiles.Save();
 
             SetTimer( hWnd, TIMER_ID_DELAY, 1000 * photoDelay, NULL );
             SetTimer( hWnd, TIMER_ID_BLANK, 60 * 1000 * blankDelay, NULL );
+            SetTimer( hWnd, TIMER_ID_CLOCK, CLOCK_POLL_MS, NULL );
 
             SetProcessWorkingSetSize( GetCurrentProcess, ~0, ~0 );
             return 0;
@@ -422,38 +1048,87 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
         {
             KillTimer( hWnd, TIMER_ID_DELAY );
             KillTimer( hWnd, TIMER_ID_BLANK );
+            KillTimer( hWnd, TIMER_ID_CLOCK );
+            KillTimer( hWnd, TIMER_ID_TRANSITION );
+            g_inTransition = false;
+            g_BadFiles.Save();
+            g_TransitionFrom.Detach();
+            g_TransitionTo.Detach();
 
             delete g_pImagePaths;
             g_pImagePaths = NULL;
 
             delete g_pCurrentBitmap;
-            delete g_pCurrentBitmapBuffer;
             g_pCurrentBitmap = NULL;
+
+            if ( NULL != g_pWic2Gdi )
+                g_pWic2Gdi->FreeBuffer( g_pCurrentBitmapBuffer );
             g_pCurrentBitmapBuffer = NULL;
 
-            if ( 0 != gdiplusToken )
+            // A decode still running in the background needs WIC, GDI+, and the frame pool. The process
+            // is going away, so if one doesn't finish soon just leave them up for it. The color job stops
+            // after the files it's working on and saves what it has.
+
+            if ( g_pColorJob )
+                g_pColorJob->stop = true;
+
+            bool workersDone = WaitForWorkers( SHUTDOWN_WAIT_MS );
+            g_pColorJob.reset();
+
+            if ( workersDone )
             {
-                GdiplusShutdown( gdiplusToken );
-                gdiplusToken = 0;
-            }
+                g_FramePool.Trim();
+
+                if ( 0 != gdiplusToken )
+                {
+                    GdiplusShutdown( gdiplusToken );
+                    gdiplusToken = 0;
+                }
 
-            delete g_pWic2Gdi;
-            g_pWic2Gdi = NULL;
+                delete g_pWic2Gdi;
+                g_pWic2Gdi = NULL;
+
+                CoUninitialize();
+            }
 
-            CoUninitialize();
+            g_Compositor.Attach( NULL, 0, 0, 0 );
+            g_BackBuffer.Destroy();
+            delete g_pTextStrips;
+            g_pTextStrips = NULL;
 
-            DeleteObject( fontText );
-            DeleteObject( brushBlack );
+            DeleteObject( g_fontText );
+            tracer.EnableBinaryRing( false );
             return 0;
         }
 
         case WM_TIMER:
         {
+            if ( TIMER_ID_TRANSITION == wParam )
+            {
+                if ( g_inTransition )
+                    RenderTransition( hWnd );
+                else
+                    KillTimer( hWnd, TIMER_ID_TRANSITION );
+                return 0;
+            }
+
+            // keep the clock current even when iteration is paused. The transition refreshes it when it ends.
+
+            if ( TIMER_ID_CLOCK == wParam )
+            {
+                if ( g_BackBuffer.Ok() && !g_inTransition )
+                    UpdateOverlays( hWnd, false );
+                return 0;
+            }
+
             if ( !iterationPaused )
             {
                 if ( TIMER_ID_BLANK == wParam && !g_blankMode )
                 {
                     g_blankMode = true;
+                    EndTransition( hWnd );
+                    g_TransitionFrom.Detach();
+                    g_TransitionTo.Detach();
 
                     if ( g_pCurrentBitmap )
                     {
@@ -463,19 +1138,30 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
 
                     if ( g_pCurrentBitmapBuffer )
                     {
-                        delete g_pCurrentBitmapBuffer;
+                        g_pWic2Gdi->FreeBuffer( g_pCurrentBitmapBuffer );
                         g_pCurrentBitmapBuffer = 0;
                     }
 
-                    InvalidateRect( hWnd, NULL, TRUE );
+                    // nothing more will be decoded once the screen is blank, so give the cached frames back
+
+                    g_FramePool.Trim();
+
+                    ComposeFrame( hWnd );
                 }
 
                 if ( TIMER_ID_DELAY == wParam )
                 {
-                    if ( !g_blankMode )
-                        LoadNextImage( true );
+                    if ( g_blankMode )
+                        UpdateOverlays( hWnd, true );
+                    else
+                    {
+                        ShowNextImage( hWnd );
+
+                        // at most one write per photo, and only when a file was newly found to be bad
 
-                    InvalidateRect( hWnd, NULL, TRUE );
+                        if ( g_BadFiles.IsDirty() )
+                            g_BadFiles.Save();
+                    }
                 }
             }
             return 0;
@@ -507,8 +1193,10 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
             else if ( VK_LEFT == wParam || VK_RIGHT == wParam )
             {
                 iterationPaused = true;
-                LoadNextImage( VK_RIGHT == wParam );
-                InvalidateRect( hWnd, NULL, TRUE );
+                EndTransition( hWnd ); // stepping by hand is a hard cut
+
+                if ( LoadNextImage( VK_RIGHT == wParam ) )
+                    ComposeFrame( hWnd );
                 return 0;
             }
             else if ( VK_UP == wParam || VK_DOWN == wParam )
@@ -536,167 +1224,26 @@ extern "C" LRESULT WINAPI ScreenSaverProc( HWND hWnd, UINT message, WPARAM wPara
 
         case WM_PAINT:
         {
-            PAINTSTRUCT ps;
-            HDC hdc = BeginPaint( hWnd, &ps );
-    
-            RECT rect;
-            GetClientRect( hWnd, &rect );
+            // Everything is composed ahead of time into the persistent back buffer.
+            // Just upload the parts of it that are invalid.
 
-            if ( 0 != rect.right && 0 != rect.bottom )
-            {
-                double arDisplay = (double) rect.right / (double) rect.bottom;
-                
-                // super-minimal multi-mon support. If displays are apparently side by side, only use the left one.
-
-                if ( arDisplay > 2.0 )
-                {
-                    rect.right /= 2;
-                    arDisplay /= 2;
-                }
+            if ( !g_BackBuffer.Ok() )
+                ComposeFrame( hWnd );
 
-                if ( 0 != g_pCurrentBitmap )
-                {
-                    int bw = g_pCurrentBitmap->GetWidth();
-                    int bh = g_pCurrentBitmap->GetHeight();
-
-                    tracer.Trace( "in wm_paint. image w %d, h %d\n", bw, bh );
+            vector<RECT> rects;
+            CGdiBackBuffer::GetUpdateRects( hWnd, rects );
 
-                    if ( 0 != bw && 0 != bh )
-                    {
-                        double arBitmap = (double) bw / (double) bh;
-
-                        int toLeft = 0;
-                        int toTop = 0;
-                        int toRight = rect.right;
-                        int toBottom = rect.bottom;
-                        int targetWidth = rect.right;
-                        int targetHeight = rect.bottom;
-
-                        if ( arBitmap > arDisplay )
-                        {
-                            // bitmap is wider than the screen
-
-                            double ratio = (double) rect.right / (double) bw;
-                            targetHeight = (int) ( ratio * (double) bh );
-                            toTop = ( rect.bottom - targetHeight ) / 2;
-                            toBottom = targetHeight;
-                        }
-                        else
-                        {
-                            // bitmap is more narrow than the screen
-
-                            double ratio = (double) rect.bottom / (double) bh;
-                            targetWidth = (int) ( ratio * (double) bw );
-                            toLeft = ( rect.right - targetWidth ) / 2;
-                            toRight = targetWidth; 
-                        }
-
-                        tracer.Trace( "arBitmap %lf, arScreen %lf, targetHeight %d, targetWidth %d, toLeft %d, toTop %d, toRight %d, toBottom %d\n",
-                                      arBitmap, arDisplay, targetHeight, targetWidth, toLeft, toTop, toRight, toBottom );
-
-                        // DrawImage into the display is visibly slow -- you can see drawing from top to bottom.
-                        // Instead, stretch the image to an offscreen backing bitmap then BLT that to the display.
-                        // Not much point in caching the offscreen hdc and bitmap since DrawImage() is where the time goes by a factor of 50:
-                        //     PID 2064 -- bitmap create 294,529,000, draw 10,930,507,700, blt 57,153,200
-                        
-                        
-                        {
-                            high_resolution_clock::time_point tA = high_resolution_clock::now();
-                            HDC hdcBack = CreateCompatibleDC( hdc );
-                            HBITMAP bmpBack = CreateCompatibleBitmap( hdc, rect.right, rect.bottom );
-                            high_resolution_clock::time_point tB = high_resolution_clock::now();
-                            timeCreate += duration_cast<std::chrono::nanoseconds>( tB - tA ).count();
-
-                            HBITMAP bmpOld = (HBITMAP) SelectObject( hdcBack, bmpBack );
-                            FillRect( hdcBack, &rect, brushBlack );
-
-                            {
-                                unique_ptr<Graphics> gDCBack( Graphics::FromHDC( hdcBack ) );
-                                gDCBack->SetCompositingMode( CompositingMode::CompositingModeSourceCopy );
-
-                                gDCBack->SetCompositingQuality( CompositingQuality::CompositingQualityHighQuality );
-                                gDCBack->SetInterpolationMode( InterpolationMode::InterpolationModeHighQualityBicubic );
-                                gDCBack->SetPixelOffsetMode( PixelOffsetMode::PixelOffsetModeHighQuality );
-
-                                // No need to SetWrapMode( Tile ) since only one image is being drawn on the Graphics object.
-
-                                Rect rectTo( toLeft, toTop, targetWidth, targetHeight );
-                                high_resolution_clock::time_point tC = high_resolution_clock::now();
-                                Status x = gDCBack->DrawImage( g_pCurrentBitmap, rectTo, 0, 0, bw, bh, UnitPixel, NULL, NULL );
-                                high_resolution_clock::time_point tD = high_resolution_clock::now();
-                                timeDraw += duration_cast<std::chrono::nanoseconds>( tD - tC ).count();
-                            }
-    
-                            int len = strlen( g_acPhotoDateTime );
-                            if ( 0 != len )
-                            {
-                                HFONT fontOld = (HFONT) SelectObject( hdcBack, fontText );
-                                COLORREF crOldBk = SetBkColor( hdcBack, RGB( 0, 0, 0 ) );
-                                COLORREF crOldText = SetTextColor( hdcBack, RGB( 140, 140, 100 ) );
-                                UINT taOld = SetTextAlign( hdcBack, TA_RIGHT );
-        
-                                RECT rectDateTime = { 0, 0, fontHeight * 10, fontHeight };
-                                ExtTextOutA( hdcBack, rect.right, rect.bottom - fontHeight, 0, &rectDateTime, g_acPhotoDateTime, len, NULL );
-
-                                WCHAR awcCurrentTime[ 6 ] = { L'h', L'h', L':', L'm', L'm', 0 };
-                                const int currentTimeLen = _countof( awcCurrentTime ) - 1;
-                                SYSTEMTIME lt = {};
-                                GetLocalTime( &lt );
-                                WordToWC( awcCurrentTime,     lt.wHour );
-                                WordToWC( awcCurrentTime + 3, lt.wMinute );
-                                ExtTextOut( hdcBack, rect.right, rect.top, 0, &rectDateTime, awcCurrentTime, currentTimeLen, NULL );
-
-                                SetTextAlign( hdcBack, taOld );
-                                SetTextColor( hdcBack, crOldText );
-                                SetBkColor( hdcBack, crOldBk );
-                                SelectObject( hdcBack, fontOld );
-                            }
-    
-                            high_resolution_clock::time_point tE = high_resolution_clock::now();
-                            BOOL bltOK = BitBlt( hdc, 0, 0, rect.right, rect.bottom, hdcBack, 0, 0, SRCCOPY );
-                            high_resolution_clock::time_point tF = high_resolution_clock::now();
-                            timeBLT += duration_cast<std::chrono::nanoseconds>( tF - tE ).count();
-    
-                            SelectObject( hdcBack, bmpOld );
-                            DeleteObject( bmpBack );
-                            DeleteObject( hdcBack );
-
-                            tracer.Trace( "bitmap create %lld, draw %lld, blt %lld\n", timeCreate, timeDraw, timeBLT );
-                        }
-                    }
-                }
-                else if ( g_showCaptureDate )
-                {
-                    // in blank mode; show the current time in a random location.
+            PAINTSTRUCT ps;
+            HDC hdc = BeginPaint( hWnd, &ps );
 
-                    FillRect( hdc, &rect, brushBlack );
+            if ( g_BackBuffer.Ok() )
+            {
+                high_resolution_clock::time_point tE = high_resolution_clock::now();
+                g_BackBuffer.Present( hdc, rects );
+                high_resolution_clock::time_point tF = high_resolution_clock::now();
+                timeBLT += duration_cast<std::chrono::nanoseconds>( tF - tE ).count();
 
-                    HFONT fontOld = (HFONT) SelectObject( hdc, fontText );
-                    COLORREF crOldBk = SetBkColor( hdc, RGB( 0, 0, 0 ) );
-                    COLORREF crOldText = SetTextColor( hdc, RGB( 140, 140, 100 ) );
-                    UINT taOld = SetTextAlign( hdc, TA_RIGHT );
-        
-                    RECT rectDateTime = { 0, 0, fontHeight * 10, fontHeight };
-
-                    WCHAR awcCurrentTime[ 6 ] = { L'h', L'h', L':', L'm', L'm', 0 };
-                    const int currentTimeLen = _countof( awcCurrentTime ) - 1;
-                    SYSTEMTIME lt = {};
-                    GetLocalTime( &lt );
-                    WordToWC( awcCurrentTime,     lt.wHour );
-                    WordToWC( awcCurrentTime + 3, lt.wMinute );
-
-                    int effectiveWidth = rect.right - rect.left - rectDateTime.right;
-                    int effectiveHeight = rect.bottom - rect.top - rectDateTime.bottom;
-                    int xoffset = rect.right - ( rand() % effectiveWidth );
-                    int yoffset = rect.top + ( rand() % effectiveHeight );
-
-                    ExtTextOut( hdc, xoffset, yoffset, 0, &rectDateTime, awcCurrentTime, currentTimeLen, NULL );
-
-                    SetTextAlign( hdc, taOld );
-                    SetTextColor( hdc, crOldText );
-                    SetBkColor( hdc, crOldBk );
-                    SelectObject( hdc, fontOld );
-                }
+                tracer.Trace( "wm_paint uploaded %zu rects. bitmap create %lld, draw %lld, blt %lld\n", rects.size(), timeCreate, timeDraw, timeBLT );
             }
 
             EndPaint( hWnd, &ps );
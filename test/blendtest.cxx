@@ -0,0 +1,272 @@
+//
+// Linux checks and throughput benchmark for the transition kernels in djl_blend.hxx.
+// The SIMD paths are compared against a scalar reference built from CBlend::Lerp.
+// Build and run with test/m.sh
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <chrono>
+#include <vector>
+
+#include <djl_blend.hxx>
+
+using namespace std;
+using namespace std::chrono;
+
+static int g_Failures = 0;
+
+#define CHECK( x ) if ( !( x ) ) { printf( "FAILED line %d: %s\n", __LINE__, #x ); g_Failures++; }
+
+static uint32_t g_Seed = 0x12345678;
+
+static uint32_t Rand32()
+{
+    g_Seed ^= g_Seed << 13;
+    g_Seed ^= g_Seed >> 17;
+    g_Seed ^= g_Seed << 5;
+    return g_Seed;
+} //Rand32
+
+static void FillRandom( CFrameBuffer & fb )
+{
+    for ( int y = 0; y < fb.Height(); y++ )
+        for ( int x = 0; x < fb.Width(); x++ )
+            fb.Row( y )[ x ] = Rand32();
+} //FillRandom
+
+static int ChannelDiff( uint32_t a, uint32_t b )
+{
+    int most = 0;
+
+    for ( int s = 0; s < 32; s += 8 )
+        most = get_max( most, abs( (int) ( ( a >> s ) & 0xff ) - (int) ( ( b >> s ) & 0xff ) ) );
+
+    return most;
+} //ChannelDiff
+
+// Same pixel-center mapping and 32.32 stepping as CBlend::SampleRow, then clamp and filter one pixel at a time
+
+static uint32_t RefSample( const CFrameBuffer & src, const CBlend::Affine & m, int x, int y )
+{
+    const double one = 4294967296.0;
+    double cy = y + 0.5;
+    int64_t u = (int64_t) llround( ( m.xx * 0.5 + m.xy * cy + m.x0 - 0.5 ) * one ) + (int64_t) llround( m.xx * one ) * x;
+    int64_t v = (int64_t) llround( ( m.yx * 0.5 + m.yy * cy + m.y0 - 0.5 ) * one ) + (int64_t) llround( m.yx * one ) * x;
+
+    int maxX = src.Width() - 1;
+    int maxY = src.Height() - 1;
+    int ui = (int) ( u >> 32 );
+    int vi = (int) ( v >> 32 );
+    uint32_t fx = (uint32_t) ( ( u >> 24 ) & 0xff );
+    uint32_t fy = (uint32_t) ( ( v >> 24 ) & 0xff );
+
+    if ( ui < 0 ) { ui = 0; fx = 0; }
+    if ( vi < 0 ) { vi = 0; fy = 0; }
+    if ( ui >= maxX ) { ui = get_max( 0, maxX - 1 ); fx = ( maxX > 0 ) ? 256 : 0; }
+    if ( vi >= maxY ) { vi = get_max( 0, maxY - 1 ); fy = ( maxY > 0 ) ? 256 : 0; }
+
+    int dx = ( maxX > 0 ) ? 1 : 0;
+    int dy = ( maxY > 0 ) ? 1 : 0;
+    const uint32_t * p0 = src.Row( vi ) + ui;
+    const uint32_t * p1 = src.Row( vi + dy ) + ui;
+
+    return CBlend::Lerp( CBlend::Lerp( p0[ 0 ], p0[ dx ], fx ), CBlend::Lerp( p1[ 0 ], p1[ dx ], fx ), fy );
+} //RefSample
+
+// The kernels filter vertically then horizontally and the reference does the reverse; rounding may differ by 1
+
+static int CheckSample( const char * name, int sw, int sh, int dw, int dh, const CBlend::Affine & m )
+{
+    CFrameBuffer src, dst;
+    src.Allocate( sw, sh );
+    dst.Allocate( dw, dh );
+    FillRandom( src );
+    dst.Fill( dst.Bounds(), 0xdeadbeef );
+
+    CBlend::SampleAffine( dst, src, m );
+
+    int worst = 0;
+
+    for ( int y = 0; y < dh; y++ )
+        for ( int x = 0; x < dw; x++ )
+            worst = get_max( worst, ChannelDiff( dst.Row( y )[ x ], RefSample( src, m, x, y ) ) );
+
+    if ( worst > 1 )
+    {
+        printf( "FAILED sample %s: %dx%d => %dx%d differs from the reference by up to %d\n", name, sw, sh, dw, dh, worst );
+        g_Failures++;
+    }
+
+    return worst;
+} //CheckSample
+
+static CBlend::Affine MakeAffine( double xx, double xy, double x0, double yx, double yy, double y0 )
+{
+    CBlend::Affine m = { xx, xy, x0, yx, yy, y0 };
+    return m;
+} //MakeAffine
+
+static CBlend::Affine Rotation( int w, int h, double degrees, double zoom )
+{
+    // rotate about the center, magnified so the corners stay mostly inside
+
+    double a = degrees * 3.14159265358979 / 180.0;
+    double c = cos( a ) / zoom, s = sin( a ) / zoom;
+    double cx = w / 2.0, cy = h / 2.0;
+    return MakeAffine( c, -s, cx - c * cx + s * cy, s, c, cy - s * cx - c * cy );
+} //Rotation
+
+static void TestSample()
+{
+    // pan and zoom inside the source
+
+    CheckSample( "zoom", 640, 360, 640, 360, CBlend::ZoomAbout( 640, 360, 1.05, 0.3, 0.7 ) );
+    CheckSample( "zoom max", 640, 360, 640, 360, CBlend::ZoomAbout( 640, 360, 3.0, 1.0, 1.0 ) );
+    CheckSample( "identity", 333, 77, 333, 77, MakeAffine( 1, 0, 0, 0, 1, 0 ) );
+    CheckSample( "downscale", 640, 360, 321, 181, MakeAffine( 2, 0, 0.25, 0, 2, 0.25 ) );
+
+    // rotation takes the per-pixel path
+
+    CheckSample( "rotate", 640, 360, 640, 360, Rotation( 640, 360, 7.0, 1.2 ) );
+    CheckSample( "rotate outside", 64, 36, 128, 72, Rotation( 64, 36, 30.0, 0.5 ) );
+
+    // rows partly or wholly outside the source take the clamped edge pixels
+
+    CheckSample( "right of source", 8, 8, 8, 8, MakeAffine( 1, 0, 20, 0, 1, 0 ) );
+    CheckSample( "left of source", 8, 8, 8, 8, MakeAffine( 1, 0, -20, 0, 1, 0 ) );
+    CheckSample( "above and below", 8, 8, 8, 8, MakeAffine( 1, 0, 0, 0, 1, 50 ) );
+    CheckSample( "straddles both edges", 8, 8, 64, 8, MakeAffine( 0.5, 0, -8, 0, 1, 0 ) );
+    CheckSample( "mirrored", 100, 50, 100, 50, MakeAffine( -1, 0, 100, 0, 1, 0 ) );
+    CheckSample( "mirrored outside", 8, 8, 8, 8, MakeAffine( -1, 0, -5, 0, 1, 0 ) );
+
+    // degenerate sources
+
+    CheckSample( "2 wide", 2, 5, 9, 9, MakeAffine( 0.3, 0, -0.5, 0, 0.7, 0 ) );
+    CheckSample( "1 wide", 1, 5, 9, 9, MakeAffine( 0.3, 0, 0, 0, 0.7, 0 ) );
+    CheckSample( "1 tall", 9, 1, 9, 9, MakeAffine( 0.7, 0, 0, 0, 0.3, 0 ) );
+    CheckSample( "1 pixel", 1, 1, 4, 4, MakeAffine( 1, 0, 0, 0, 1, 0 ) );
+
+    // the specific repro: an 8x8 source shifted 20 pixels left must show its right edge column, not zeros
+
+    CFrameBuffer src, dst;
+    src.Allocate( 8, 8 );
+    dst.Allocate( 8, 8 );
+    FillRandom( src );
+    CBlend::SampleAffine( dst, src, MakeAffine( 1, 0, 20, 0, 1, 0 ) );
+
+    for ( int y = 0; y < 8; y++ )
+        for ( int x = 0; x < 8; x++ )
+            CHECK( dst.Row( y )[ x ] == src.Row( y )[ 7 ] );
+} //TestSample
+
+static void TestBlend()
+{
+    const int w = 517, h = 67; // odd width exercises the scalar tail
+    CFrameBuffer a, b, d;
+    a.Allocate( w, h );
+    b.Allocate( w, h );
+    d.Allocate( w, h );
+    FillRandom( a );
+    FillRandom( b );
+
+    uint32_t alphas[] = { 0, 1, 77, 128, 255, 256, 300 };
+
+    for ( size_t i = 0; i < sizeof alphas / sizeof alphas[ 0 ]; i++ )
+    {
+        uint32_t alpha = alphas[ i ];
+        CBlend::BlendFrames( d, a, b, alpha );
+
+        int bad = 0;
+        for ( int y = 0; y < h; y++ )
+            for ( int x = 0; x < w; x++ )
+                if ( d.Row( y )[ x ] != CBlend::Lerp( a.Row( y )[ x ], b.Row( y )[ x ], get_min( alpha, 256u ) ) )
+                    bad++;
+
+        if ( 0 != bad )
+        {
+            printf( "FAILED blend alpha %u: %d pixels differ from Lerp\n", alpha, bad );
+            g_Failures++;
+        }
+    }
+
+    // in place, as photoss does into the back buffer
+
+    CFrameBuffer c;
+    c.Allocate( w, h );
+    c.Blit( 0, 0, a );
+    CBlend::BlendFrames( c, c, b, 100 );
+    CBlend::BlendFrames( d, a, b, 100 );
+
+    bool same = true;
+    for ( int y = 0; y < h; y++ )
+        same = same && ( 0 == memcmp( c.Row( y ), d.Row( y ), w * sizeof( uint32_t ) ) );
+
+    CHECK( same );
+} //TestBlend
+
+template <typename T> static double TimeMS( int iterations, const T & work )
+{
+    work(); // warm up the threads and fault in the pages
+
+    high_resolution_clock::time_point tStart = high_resolution_clock::now();
+
+    for ( int i = 0; i < iterations; i++ )
+        work();
+
+    return (double) duration_cast<std::chrono::microseconds>( high_resolution_clock::now() - tStart ).count() / 1000.0 / iterations;
+} //TimeMS
+
+static void Bench()
+{
+    const int w = 3840, h = 2160, iterations = 50;
+    const double mb = (double) w * h * sizeof( uint32_t ) / ( 1024.0 * 1024.0 );
+
+    CFrameBuffer a, b, d;
+    a.Allocate( w, h );
+    b.Allocate( w, h );
+    d.Allocate( w, h );
+    FillRandom( a );
+    FillRandom( b );
+
+    uint32_t alpha = 0;
+    double ms = TimeMS( iterations, [&] () { CBlend::BlendFrames( d, a, b, ( alpha++ ) & 0xff ); } );
+    printf( "BlendFrames  %dx%d: %6.2f ms per frame, %7.1f frames/s, %6.2f GB/s (2 reads + 1 write)\n",
+            w, h, ms, 1000.0 / ms, 3.0 * mb / 1024.0 / ( ms / 1000.0 ) );
+
+    double zoom = 1.0;
+    ms = TimeMS( iterations, [&] ()
+    {
+        CBlend::SampleAffine( d, b, CBlend::ZoomAbout( w, h, zoom, 0.3, 0.7 ) );
+        zoom += 0.001;
+    } );
+    printf( "SampleAffine %dx%d zoom:   %6.2f ms per frame, %7.1f frames/s\n", w, h, ms, 1000.0 / ms );
+
+    ms = TimeMS( iterations / 5, [&] () { CBlend::SampleAffine( d, b, Rotation( w, h, 3.0, 1.1 ) ); } );
+    printf( "SampleAffine %dx%d rotate: %6.2f ms per frame, %7.1f frames/s\n", w, h, ms, 1000.0 / ms );
+
+    // the scalar reference, for scale; one band of rows is plenty to time it
+
+    const int rows = 64;
+    volatile uint32_t sink = 0;
+    ms = TimeMS( 3, [&] ()
+    {
+        for ( int y = 0; y < rows; y++ )
+            for ( int x = 0; x < w; x++ )
+                sink = sink + CBlend::Lerp( a.Row( y )[ x ], b.Row( y )[ x ], 100 );
+    } ) * h / rows;
+    printf( "scalar Lerp  %dx%d, 1 thread: %6.2f ms per frame\n", w, h, ms );
+} //Bench
+
+int main( int argc, char * argv[] )
+{
+    TestBlend();
+    TestSample();
+    Bench();
+
+    printf( "blendtest: %s\n", ( 0 == g_Failures ) ? "pass" : "FAIL" );
+    return ( 0 == g_Failures ) ? 0 : 1;
+} //main
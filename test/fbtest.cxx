@@ -0,0 +1,240 @@
+//
+// Linux checks and a timing for the portable compositor in djl_fb.hxx.
+// Build and run with test/m.sh
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <vector>
+#include <string>
+
+#include <djl_fb.hxx>
+
+using namespace std;
+using namespace std::chrono;
+
+static int g_Failures = 0;
+
+#define CHECK( x ) if ( !( x ) ) { printf( "FAILED line %d: %s\n", __LINE__, #x ); g_Failures++; }
+
+static bool SameRect( const FBRect & a, int l, int t, int r, int b )
+{
+    return ( a.left == l ) && ( a.top == t ) && ( a.right == r ) && ( a.bottom == b );
+} //SameRect
+
+static FBRect MakeRect( int l, int t, int r, int b )
+{
+    FBRect x = { l, t, r, b };
+    return x;
+} //MakeRect
+
+static void TestDirtyRects()
+{
+    vector<FBRect> out;
+    CDirtyRects dirty;
+
+    // overlapping and adjacent rects merge into one when the union wastes nothing
+
+    dirty.Add( MakeRect( 0, 0, 10, 10 ) );
+    dirty.Add( MakeRect( 10, 0, 20, 10 ) );
+    dirty.Add( MakeRect( 5, 5, 15, 10 ) );
+    dirty.Take( out );
+    CHECK( 1 == out.size() );
+    CHECK( SameRect( out[ 0 ], 0, 0, 20, 10 ) );
+    CHECK( dirty.Empty() );
+
+    // far apart rects stay separate
+
+    dirty.Add( MakeRect( 0, 0, 10, 10 ) );
+    dirty.Add( MakeRect( 100, 100, 110, 110 ) );
+    dirty.Take( out );
+    CHECK( 2 == out.size() );
+
+    // empty rects are ignored
+
+    dirty.Add( MakeRect( 5, 5, 5, 20 ) );
+    CHECK( dirty.Empty() );
+
+    // a merge that makes the rect bigger can pick up another rect it now overlaps
+
+    dirty.Add( MakeRect( 0, 0, 10, 10 ) );
+    dirty.Add( MakeRect( 20, 0, 30, 10 ) );
+    dirty.Add( MakeRect( 10, 0, 20, 10 ) );
+    dirty.Take( out );
+    CHECK( 1 == out.size() );
+    CHECK( SameRect( out[ 0 ], 0, 0, 30, 10 ) );
+
+    // past MaxRects (16) scattered rects collapse into their bounding box
+
+    for ( int i = 0; i < 16; i++ )
+        dirty.Add( MakeRect( i * 100, i * 100, i * 100 + 10, i * 100 + 10 ) );
+    dirty.Take( out );
+    CHECK( 16 == out.size() );
+
+    for ( int i = 0; i < 17; i++ )
+        dirty.Add( MakeRect( i * 100, i * 100, i * 100 + 10, i * 100 + 10 ) );
+    dirty.Take( out );
+    CHECK( 1 == out.size() );
+    CHECK( SameRect( out[ 0 ], 0, 0, 1610, 1610 ) );
+} //TestDirtyRects
+
+static uint32_t Pattern( int x, int y ) { return 0xff000000 | ( (uint32_t) y << 12 ) | (uint32_t) x; }
+
+static bool FrameIsPattern( CFrameBuffer & fb )
+{
+    for ( int y = 0; y < fb.Height(); y++ )
+        for ( int x = 0; x < fb.Width(); x++ )
+            if ( fb.Row( y )[ x ] != Pattern( x, y ) )
+                return false;
+
+    return true;
+} //FrameIsPattern
+
+static void FillPattern( CFrameBuffer & fb )
+{
+    for ( int y = 0; y < fb.Height(); y++ )
+        for ( int x = 0; x < fb.Width(); x++ )
+            fb.Row( y )[ x ] = Pattern( x, y );
+} //FillPattern
+
+static void TestOverlay()
+{
+    const int w = 200, h = 100;
+    const uint32_t ink = 0x00abcdef;
+    int renders = 0;
+
+    CFrameCompositor comp;
+    comp.Allocate( w, h );
+
+    // each character is a 4x8 block
+
+    comp.SetStripRenderer( [&]( const wstring & text, CFrameBuffer & strip ) -> bool
+    {
+        renders++;
+        strip.Allocate( 4 * (int) text.size(), 8 );
+        strip.Fill( strip.Bounds(), ink );
+        return true;
+    } );
+
+    comp.BeginFrame( 0 );
+    FillPattern( comp.Frame() );
+    comp.EndFrame();
+
+    vector<FBRect> out;
+    comp.TakeDirty( out );
+    CHECK( 1 == out.size() );
+    CHECK( SameRect( out[ 0 ], 0, 0, w, h ) );
+
+    // showing an overlay dirties just its strip
+
+    comp.SetOverlay( 0, L"12:34", 190, 5 );
+    comp.TakeDirty( out );
+    CHECK( 1 == out.size() );
+    CHECK( SameRect( out[ 0 ], 170, 5, 190, 13 ) );
+    CHECK( ink == comp.Frame().Row( 5 )[ 170 ] );
+    CHECK( ink == comp.Frame().Row( 12 )[ 189 ] );
+    CHECK( Pattern( 169, 5 ) == comp.Frame().Row( 5 )[ 169 ] );
+    CHECK( Pattern( 190, 5 ) == comp.Frame().Row( 5 )[ 190 ] );
+
+    // the same text in the same place does nothing
+
+    comp.SetOverlay( 0, L"12:34", 190, 5 );
+    CHECK( !comp.IsDirty() );
+    CHECK( 1 == renders );
+
+    // moving it restores what was under the old spot; old and new spots are far apart so that's two rects
+
+    comp.SetOverlay( 0, L"12:34", 60, 80 );
+    comp.TakeDirty( out );
+    CHECK( 2 == out.size() );
+    CHECK( SameRect( out[ 0 ], 170, 5, 190, 13 ) );
+    CHECK( SameRect( out[ 1 ], 40, 80, 60, 88 ) );
+    CHECK( Pattern( 170, 5 ) == comp.Frame().Row( 5 )[ 170 ] );
+    CHECK( 1 == renders );
+
+    // a strip partly off the frame is clipped, and only the visible part is dirtied
+
+    comp.SetOverlay( 1, L"abc", 5, 95 );
+    comp.TakeDirty( out );
+    CHECK( 1 == out.size() );
+    CHECK( SameRect( out[ 0 ], 0, 95, 5, h ) );
+
+    // hiding both brings back every original pixel and dirties only the strips
+
+    comp.HideOverlay( 0 );
+    comp.HideOverlay( 1 );
+    comp.TakeDirty( out );
+    CHECK( 2 == out.size() );
+    CHECK( SameRect( out[ 0 ], 40, 80, 60, 88 ) );
+    CHECK( SameRect( out[ 1 ], 0, 95, 5, h ) );
+    CHECK( FrameIsPattern( comp.Frame() ) );
+
+    // hiding again does nothing
+
+    comp.HideOverlay( 0 );
+    CHECK( !comp.IsDirty() );
+
+    // after a recomposition EndFrame puts a visible overlay back on top of the new frame
+
+    comp.SetOverlay( 0, L"9", 200, 0 );
+    comp.BeginFrame( 0 );
+    FillPattern( comp.Frame() );
+    comp.EndFrame();
+    CHECK( ink == comp.Frame().Row( 0 )[ 199 ] );
+    comp.HideOverlay( 0 );
+    CHECK( FrameIsPattern( comp.Frame() ) );
+} //TestOverlay
+
+static void BenchOverlay()
+{
+    // a 4K frame with a ticking clock: the work per tick should be the strip, not the frame
+
+    const int w = 3840, h = 2160, ticks = 10000;
+    CFrameCompositor comp;
+    comp.Allocate( w, h );
+    comp.SetStripRenderer( []( const wstring & text, CFrameBuffer & strip ) -> bool
+    {
+        strip.Allocate( 24 * (int) text.size(), 64 );
+        strip.Fill( strip.Bounds(), 0x00ffffff );
+        return true;
+    } );
+
+    comp.BeginFrame( 0 );
+    FillPattern( comp.Frame() );
+    comp.EndFrame();
+
+    vector<FBRect> out;
+    comp.TakeDirty( out );
+    long long dirtyArea = 0;
+    wchar_t awc[ 20 ];
+
+    high_resolution_clock::time_point tStart = high_resolution_clock::now();
+
+    for ( int i = 0; i < ticks; i++ )
+    {
+        swprintf( awc, sizeof awc / sizeof awc[ 0 ], L"%02d:%02d", ( i / 60 ) % 24, i % 60 );
+        comp.SetOverlay( 0, awc, w - 20, 20 );
+        comp.TakeDirty( out );
+
+        for ( size_t r = 0; r < out.size(); r++ )
+            dirtyArea += out[ r ].Area();
+    }
+
+    double ms = (double) duration_cast<std::chrono::microseconds>( high_resolution_clock::now() - tStart ).count() / 1000.0;
+
+    printf( "overlay: %d clock ticks on %dx%d in %.2f ms, %.2f us per tick, %.4f%% of the frame dirtied per tick\n",
+            ticks, w, h, ms, ms * 1000.0 / ticks, 100.0 * (double) dirtyArea / ticks / ( (double) w * h ) );
+} //BenchOverlay
+
+int main( int argc, char * argv[] )
+{
+    TestDirtyRects();
+    TestOverlay();
+    BenchOverlay();
+
+    printf( "fbtest: %s\n", ( 0 == g_Failures ) ? "pass" : "FAIL" );
+    return ( 0 == g_Failures ) ? 0 : 1;
+} //main
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Build and run the Linux checks and benchmarks for the portable headers.
+
+cd "$(dirname "$0")" || exit 1
+
+fail=0
+
+for t in fbtest blendtest tracetest pooltest
+do
+    g++ -std=c++17 -O3 -march=native -I.. $t.cxx -o $t -lpthread || exit 1
+    ./$t || fail=1
+done
+
+exit $fail
@@ -0,0 +1,310 @@
+#ifndef UNICODE
+#define UNICODE
+#endif
+
+//
+// Windows checks for CMetadataEditor in djl_metaedit.hxx. Small JPG and TIF files are written to %temp%,
+// edited, and compared byte for byte with what they should be afterwards. Covers set, toggle, and rotate,
+// big and little endian TIFF, the second orientation copy, and reparsing when cached offsets go stale.
+// Built and run by m.bat
+//
+
+#include <windows.h>
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <djltrace.hxx>
+#include <djl_metaedit.hxx>
+
+using namespace std;
+
+CDJLTrace tracer;
+
+static int g_Failures = 0;
+
+#define CHECK( x ) if ( !( x ) ) { printf( "FAILED line %d: %s\n", __LINE__, #x ); g_Failures++; }
+
+class CBytes
+{
+    public:
+        vector<BYTE> b;
+        bool littleEndian;
+
+        CBytes( bool le ) : littleEndian( le ) {}
+
+        void U8( BYTE x ) { b.push_back( x ); }
+
+        void U16( WORD x )
+        {
+            if ( littleEndian ) { U8( x & 0xff ); U8( x >> 8 ); }
+            else { U8( x >> 8 ); U8( x & 0xff ); }
+        } //U16
+
+        void U32( DWORD x )
+        {
+            if ( littleEndian ) { U16( x & 0xffff ); U16( x >> 16 ); }
+            else { U16( x >> 16 ); U16( x & 0xffff ); }
+        } //U32
+
+        void Append( const void * p, size_t cb ) { b.insert( b.end(), (const BYTE *) p, (const BYTE *) p + cb ); }
+
+        void Entry( WORD id, WORD type, DWORD count, DWORD value )
+        {
+            U16( id );
+            U16( type );
+            U32( count );
+
+            if ( 3 == type && 1 == count )
+            {
+                U16( (WORD) value ); // SHORTs sit in the first two bytes of the field
+                U16( 0 );
+            }
+            else
+                U32( value );
+        } //Entry
+}; //CBytes
+
+// pad moves the rating within the XMP without changing its length, like an app rewriting it would
+
+static string MakeXMP( int rating, int pad )
+{
+    string xmp = "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"><rdf:RDF><rdf:Description";
+    xmp += string( 1 + pad, ' ' );
+    xmp += "xmp:Rating=\"";
+    xmp += (char) ( '0' + rating );
+    xmp += "\"";
+    xmp += string( 9 - pad, ' ' );
+    xmp += "/></rdf:RDF></x:xmpmeta>";
+    return xmp;
+} //MakeXMP
+
+// orientation2: 0 for one copy, otherwise a second copy in IFD1. rating: -1 for no XMP
+
+static vector<BYTE> MakeTIF( bool littleEndian, int orientation, int orientation2, int rating, int pad = 0 )
+{
+    CBytes t( littleEndian );
+    string xmp = ( rating >= 0 ) ? MakeXMP( rating, pad ) : string();
+    DWORD entries0 = ( rating >= 0 ) ? 2 : 1;
+    DWORD ifd1 = 8 + 2 + 12 * entries0 + 4;
+    DWORD xmpOffset = ifd1 + ( ( 0 != orientation2 ) ? ( 2 + 12 + 4 ) : 0 );
+
+    t.Append( littleEndian ? "II" : "MM", 2 );
+    t.U16( 42 );
+    t.U32( 8 );
+
+    t.U16( (WORD) entries0 );
+    t.Entry( 274, 3, 1, orientation );
+    if ( rating >= 0 )
+        t.Entry( 700, 1, (DWORD) xmp.size(), xmpOffset );
+    t.U32( ( 0 != orientation2 ) ? ifd1 : 0 );
+
+    if ( 0 != orientation2 )
+    {
+        t.U16( 1 );
+        t.Entry( 274, 3, 1, orientation2 );
+        t.U32( 0 );
+    }
+
+    t.Append( xmp.data(), xmp.size() );
+    return t.b;
+} //MakeTIF
+
+static vector<BYTE> MakeJPG( int orientation, int rating, int pad = 0 )
+{
+    CBytes j( false );
+    vector<BYTE> tif = MakeTIF( true, orientation, 0, -1 );
+    string xmpHeader( "http://ns.adobe.com/xap/1.0/" );
+    string xmp = MakeXMP( rating, pad );
+
+    j.U16( 0xffd8 );
+
+    j.U16( 0xffe1 );
+    j.U16( (WORD) ( 2 + 6 + tif.size() ) );
+    j.Append( "Exif\0\0", 6 );
+    j.Append( tif.data(), tif.size() );
+
+    j.U16( 0xffe1 );
+    j.U16( (WORD) ( 2 + xmpHeader.size() + 1 + xmp.size() ) );
+    j.Append( xmpHeader.c_str(), xmpHeader.size() + 1 );
+    j.Append( xmp.data(), xmp.size() );
+
+    j.U16( 0xffda );
+    j.U16( 2 );
+    j.b.resize( j.b.size() + 16 ); // stands in for the scan data
+    j.U16( 0xffd9 );
+    return j.b;
+} //MakeJPG
+
+static void WriteBytes( const wstring & path, const vector<BYTE> & bytes )
+{
+    FILE * fp = _wfopen( path.c_str(), L"wb" );
+    CHECK( NULL != fp );
+
+    if ( NULL != fp )
+    {
+        fwrite( bytes.data(), 1, bytes.size(), fp );
+        fclose( fp );
+    }
+} //WriteBytes
+
+static vector<BYTE> ReadBytes( const wstring & path )
+{
+    vector<BYTE> bytes;
+    FILE * fp = _wfopen( path.c_str(), L"rb" );
+
+    if ( NULL != fp )
+    {
+        BYTE buf[ 4096 ];
+        size_t cb;
+        while ( 0 != ( cb = fread( buf, 1, sizeof buf, fp ) ) )
+            bytes.insert( bytes.end(), buf, buf + cb );
+        fclose( fp );
+    }
+
+    return bytes;
+} //ReadBytes
+
+// Replace a file's contents but keep its size and last write time, so the editor's cached offsets look current
+
+static void RewriteBehindCache( const wstring & path, const vector<BYTE> & bytes )
+{
+    WIN32_FILE_ATTRIBUTE_DATA before;
+    CHECK( GetFileAttributesEx( path.c_str(), GetFileExInfoStandard, &before ) );
+    CHECK( ReadBytes( path ).size() == bytes.size() );
+
+    WriteBytes( path, bytes );
+
+    HANDLE h = CreateFile( path.c_str(), FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, 0, NULL );
+    CHECK( INVALID_HANDLE_VALUE != h );
+
+    if ( INVALID_HANDLE_VALUE != h )
+    {
+        CHECK( SetFileTime( h, NULL, NULL, &before.ftLastWriteTime ) );
+        CloseHandle( h );
+    }
+} //RewriteBehindCache
+
+static bool Apply( CMetadataEditor & editor, const wstring & path, CMetadataEditor::EditKind kind, int value, int expected )
+{
+    vector<CMetadataEditor::Edit> edits;
+    edits.push_back( CMetadataEditor::MakeEdit( path.c_str(), kind, value ) );
+    editor.Apply( edits );
+
+    return edits[ 0 ].ok && ( expected == edits[ 0 ].newValue );
+} //Apply
+
+static void TestRating( const wstring & dir )
+{
+    CMetadataEditor editor;
+    wstring jpg = dir + L"rating.jpg";
+
+    WriteBytes( jpg, MakeJPG( 1, 2 ) );
+
+    CHECK( Apply( editor, jpg, CMetadataEditor::editToggleRating, 0, 3 ) );
+    CHECK( ReadBytes( jpg ) == MakeJPG( 1, 3 ) );
+
+    // these two use the offsets cached by the first
+
+    CHECK( Apply( editor, jpg, CMetadataEditor::editSetRating, 5, 5 ) );
+    CHECK( Apply( editor, jpg, CMetadataEditor::editToggleRating, 0, 0 ) );
+    CHECK( ReadBytes( jpg ) == MakeJPG( 1, 0 ) );
+
+    CHECK( !Apply( editor, jpg, CMetadataEditor::editSetRating, 6, 6 ) );
+    CHECK( ReadBytes( jpg ) == MakeJPG( 1, 0 ) );
+
+    // another app moved the rating without changing the size or time; the editor must find it again
+
+    RewriteBehindCache( jpg, MakeJPG( 1, 0, 4 ) );
+    CHECK( Apply( editor, jpg, CMetadataEditor::editSetRating, 4, 4 ) );
+    CHECK( ReadBytes( jpg ) == MakeJPG( 1, 4, 4 ) );
+
+    // no XMP, so no rating to change, and the file is left alone
+
+    wstring tif = dir + L"norating.tif";
+    WriteBytes( tif, MakeTIF( false, 1, 0, -1 ) );
+    CHECK( !Apply( editor, tif, CMetadataEditor::editSetRating, 3, 3 ) );
+    CHECK( ReadBytes( tif ) == MakeTIF( false, 1, 0, -1 ) );
+} //TestRating
+
+static void TestOrientation( const wstring & dir )
+{
+    CMetadataEditor editor;
+
+    // both copies are rotated; 1 --> 6 --> 3 and back
+
+    wstring le = dir + L"twocopies.tif";
+    WriteBytes( le, MakeTIF( true, 1, 1, 2 ) );
+
+    CHECK( Apply( editor, le, CMetadataEditor::editRotate, 1, 6 ) );
+    CHECK( ReadBytes( le ) == MakeTIF( true, 6, 6, 2 ) );
+    CHECK( Apply( editor, le, CMetadataEditor::editRotate, 1, 3 ) );
+    CHECK( Apply( editor, le, CMetadataEditor::editRotate, 0, 6 ) );
+    CHECK( Apply( editor, le, CMetadataEditor::editRotate, 0, 1 ) );
+    CHECK( ReadBytes( le ) == MakeTIF( true, 1, 1, 2 ) );
+
+    // the second copy changed behind the cache's back: the editor reparses, then writes both from the first
+
+    RewriteBehindCache( le, MakeTIF( true, 1, 3, 2 ) );
+    CHECK( Apply( editor, le, CMetadataEditor::editRotate, 1, 6 ) );
+    CHECK( ReadBytes( le ) == MakeTIF( true, 6, 6, 2 ) );
+
+    // a fresh editor parses copies that disagree and still writes both
+
+    CMetadataEditor fresh;
+    WriteBytes( le, MakeTIF( true, 8, 3, 2 ) );
+    CHECK( Apply( fresh, le, CMetadataEditor::editSetOrientation, 3, 3 ) );
+    CHECK( ReadBytes( le ) == MakeTIF( true, 3, 3, 2 ) );
+
+    // big endian
+
+    wstring be = dir + L"bigendian.tif";
+    WriteBytes( be, MakeTIF( false, 1, 0, -1 ) );
+    CHECK( Apply( editor, be, CMetadataEditor::editSetOrientation, 8, 8 ) );
+    CHECK( ReadBytes( be ) == MakeTIF( false, 8, 0, -1 ) );
+    CHECK( !Apply( editor, be, CMetadataEditor::editSetOrientation, 9, 9 ) );
+    CHECK( ReadBytes( be ) == MakeTIF( false, 8, 0, -1 ) );
+} //TestOrientation
+
+static void TestBatch( const wstring & dir )
+{
+    // several files and several edits per file in one Apply; each file's edits run in order
+
+    CMetadataEditor editor;
+    wstring a = dir + L"batch_a.jpg";
+    wstring b = dir + L"batch_b.tif";
+    WriteBytes( a, MakeJPG( 1, 0 ) );
+    WriteBytes( b, MakeTIF( true, 6, 6, 1 ) );
+
+    vector<CMetadataEditor::Edit> edits;
+    edits.push_back( CMetadataEditor::MakeEdit( a.c_str(), CMetadataEditor::editSetRating, 3 ) );
+    edits.push_back( CMetadataEditor::MakeEdit( b.c_str(), CMetadataEditor::editRotate, 0 ) );
+    edits.push_back( CMetadataEditor::MakeEdit( a.c_str(), CMetadataEditor::editToggleRating ) );
+    edits.push_back( CMetadataEditor::MakeEdit( b.c_str(), CMetadataEditor::editToggleRating ) );
+    edits.push_back( CMetadataEditor::MakeEdit( a.c_str(), CMetadataEditor::editRotate, 1 ) );
+
+    CHECK( 5 == editor.Apply( edits ) );
+    CHECK( 4 == edits[ 2 ].newValue );
+    CHECK( 1 == edits[ 1 ].newValue );
+    CHECK( 2 == edits[ 3 ].newValue );
+    CHECK( 6 == edits[ 4 ].newValue );
+    CHECK( ReadBytes( a ) == MakeJPG( 6, 4 ) );
+    CHECK( ReadBytes( b ) == MakeTIF( true, 1, 1, 2 ) );
+} //TestBatch
+
+int wmain( int argc, WCHAR * argv[] )
+{
+    WCHAR awcTemp[ MAX_PATH ];
+    GetTempPath( _countof( awcTemp ), awcTemp );
+    wstring dir = wstring( awcTemp ) + L"metaedittest\\";
+    CreateDirectory( dir.c_str(), NULL );
+
+    TestRating( dir );
+    TestOrientation( dir );
+    TestBatch( dir );
+
+    printf( "metaedittest: %s\n", ( 0 == g_Failures ) ? "pass" : "FAIL" );
+    return ( 0 == g_Failures ) ? 0 : 1;
+} //wmain
@@ -0,0 +1,193 @@
+//
+// Linux checks for the frame buffer pool in djl_bufpool.hxx: size classes and the reuse window,
+// steady-state reuse, the cap on cached bytes, and falling back from huge pages to regular pages.
+// Build and run with test/m.sh
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <djltrace.hxx>
+#include <djl_bufpool.hxx>
+
+using namespace std;
+
+CDJLTrace tracer;
+
+static int g_Failures = 0;
+
+#define CHECK( x ) if ( !( x ) ) { printf( "FAILED line %d: %s\n", __LINE__, #x ); g_Failures++; }
+
+static size_t g_Page = 4096;
+
+// Allocate a, free it, then allocate b. True if b got a's buffer back.
+
+static bool Reused( size_t a, size_t b )
+{
+    CBufferPool pool;
+    uint8_t * pa = pool.Allocate( a );
+    pool.Free( pa );
+
+    uint8_t * pb = pool.Allocate( b );
+    bool reused = ( pa == pb ) && ( 1 == pool.Reuses() ) && ( 1 == pool.OSAllocations() );
+    pool.Free( pb );
+    return reused;
+} //Reused
+
+static void TestSizeClasses()
+{
+    // within a page, and rounded up to whole pages
+
+    CHECK( Reused( 1, g_Page ) );
+    CHECK( Reused( g_Page, 1 ) );
+    CHECK( !Reused( 1, g_Page + 1 ) );
+
+    // 100 pages: 4 steps per power of two, so steps of 16 pages above 64, and the class is 112 pages.
+    // 72 pages is in the 80 page class, and 112 <= 1.5 * 80 so the buffer is reused.
+    // 64 pages is its own class and 112 > 1.5 * 64. 113 pages needs the 128 page class.
+
+    CHECK( Reused( 100 * g_Page, 112 * g_Page ) );
+    CHECK( Reused( 100 * g_Page, 97 * g_Page ) );
+    CHECK( Reused( 100 * g_Page, 72 * g_Page ) );
+    CHECK( !Reused( 100 * g_Page, 64 * g_Page ) );
+    CHECK( !Reused( 100 * g_Page, 113 * g_Page ) );
+
+    // never a smaller buffer than asked for
+
+    CHECK( !Reused( 72 * g_Page, 100 * g_Page ) );
+
+    // a 4K frame and one a few rows shorter share a class
+
+    CHECK( Reused( 3840 * 2160 * 4, 3840 * 2100 * 4 ) );
+} //TestSizeClasses
+
+static void TestSteadyState()
+{
+    // a slideshow: the current frame, the next one, and a transition frame, with sizes that vary a little
+
+    CBufferPool pool;
+    const size_t sizes[] = { 3840 * 2160 * 4, 3840 * 2154 * 4, 3800 * 2160 * 4, 3840 * 2140 * 4 };
+    uint8_t * current = NULL;
+    size_t warmAllocations = 0;
+
+    for ( int i = 0; i < 400; i++ )
+    {
+        size_t cb = sizes[ i % 4 ];
+        uint8_t * next = pool.Allocate( cb );
+        uint8_t * transition = pool.Allocate( cb );
+        CHECK( NULL != next && NULL != transition );
+
+        memset( next, i, cb );
+        memset( transition, i, cb );
+
+        pool.Free( transition );
+        pool.Free( current );
+        current = next;
+
+        if ( 10 == i )
+            warmAllocations = pool.OSAllocations();
+    }
+
+    pool.Free( current );
+
+    printf( "steady state: %zu OS allocations, %zu reuses\n", pool.OSAllocations(), pool.Reuses() );
+    CHECK( warmAllocations == pool.OSAllocations() );
+    CHECK( pool.OSAllocations() <= 4 );
+} //TestSteadyState
+
+static void TestMaxCached()
+{
+    // room for two cached buffers; the other two go back to the OS when freed
+
+    const size_t cb = 64 * g_Page;
+    CBufferPool pool( false, 2 * cb );
+    vector<uint8_t *> p;
+
+    for ( int i = 0; i < 4; i++ )
+        p.push_back( pool.Allocate( cb ) );
+
+    for ( int i = 0; i < 4; i++ )
+        pool.Free( p[ i ] );
+
+    CHECK( 4 == pool.OSAllocations() );
+
+    for ( int i = 0; i < 4; i++ )
+        p[ i ] = pool.Allocate( cb );
+
+    CHECK( 2 == pool.Reuses() );
+    CHECK( 6 == pool.OSAllocations() );
+
+    for ( int i = 0; i < 4; i++ )
+        pool.Free( p[ i ] );
+
+    pool.Trim();
+
+    for ( int i = 0; i < 2; i++ )
+        p[ i ] = pool.Allocate( cb );
+
+    CHECK( 2 == pool.Reuses() );   // Trim returned everything
+    CHECK( 8 == pool.OSAllocations() );
+
+    for ( int i = 0; i < 2; i++ )
+        pool.Free( p[ i ] );
+} //TestMaxCached
+
+static void TestHugePageFallback()
+{
+    CBufferPool pool( true );
+
+    if ( !pool.UsingLargePages() )
+    {
+        printf( "huge pages: not requested successfully; skipping the fallback check\n" );
+        return;
+    }
+
+    uint8_t * first = pool.Allocate( 1 );
+    CHECK( NULL != first );
+
+    if ( pool.UsingLargePages() )
+    {
+        // this machine has huge pages reserved, so there's nothing to fall back from
+
+        printf( "huge pages: available; skipping the fallback check\n" );
+        pool.Free( first );
+        return;
+    }
+
+    // The first allocation failed with MAP_HUGETLB and fell back. Its 2 MB class is cached now. With the
+    // page size back to regular pages, a 1 byte request is a 1 page class and doesn't fit the 1.5x window.
+
+    memset( first, 1, 2 * 1024 * 1024 );
+    pool.Free( first );
+
+    uint8_t * small = pool.Allocate( 1 );
+    CHECK( NULL != small );
+    CHECK( 0 == pool.Reuses() );
+    CHECK( 2 == pool.OSAllocations() );
+
+    uint8_t * again = pool.Allocate( 2 * 1024 * 1024 );
+    CHECK( first == again );
+    CHECK( 1 == pool.Reuses() );
+
+    printf( "huge pages: fell back to %zu byte pages\n", g_Page );
+    pool.Free( small );
+    pool.Free( again );
+} //TestHugePageFallback
+
+int main( int argc, char * argv[] )
+{
+    g_Page = (size_t) sysconf( _SC_PAGESIZE );
+
+    TestSizeClasses();
+    TestSteadyState();
+    TestMaxCached();
+    TestHugePageFallback();
+
+    printf( "pooltest: %s\n", ( 0 == g_Failures ) ? "pass" : "FAIL" );
+    return ( 0 == g_Failures ) ? 0 : 1;
+} //main
@@ -0,0 +1,211 @@
+//
+// Linux checks for the ring buffer mode in djltrace.hxx: Trace and TraceFast output stays in call order,
+// each thread's lines stay in order, Trace lines are never dropped, even when a ring is tiny, and the
+// rings of threads that have exited are freed.
+// Build and run with test/m.sh
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+
+#include <djltrace.hxx>
+
+using namespace std;
+
+CDJLTrace tracer;
+
+static int g_Failures = 0;
+
+#define CHECK( x ) if ( !( x ) ) { printf( "FAILED line %d: %s\n", __LINE__, #x ); g_Failures++; }
+
+static const char * LogFile = "tracetest.txt";
+
+static vector<string> ReadLines()
+{
+    vector<string> lines;
+    ifstream f( LogFile );
+    string line;
+
+    while ( getline( f, line ) )
+        lines.push_back( line );
+
+    return lines;
+} //ReadLines
+
+static void TestInterleaved()
+{
+    tracer.Enable( true, LogFile, true );
+    tracer.SetQuiet( true );
+    tracer.EnableBinaryRing( true, 64 * 1024, 1000 );
+
+    tracer.Trace( "trace 1\n" );
+    tracer.TraceFast<traceVerbose>( "fast %d %ls\n", 2, L"two" );
+    tracer.Trace( "trace %d %s\n", 3, "three" );
+    tracer.TraceQuiet( "quiet 4\n" );
+    tracer.TraceFast<traceInfo>( "fast %d\n", 5 );
+
+    tracer.EnableBinaryRing( false );
+    tracer.Shutdown();
+
+    vector<string> lines = ReadLines();
+    CHECK( 5 == lines.size() );
+
+    if ( 5 == lines.size() )
+    {
+        CHECK( "trace 1" == lines[ 0 ] );
+        CHECK( "fast 2 two" == lines[ 1 ] );
+        CHECK( "trace 3 three" == lines[ 2 ] );
+        CHECK( "quiet 4" == lines[ 3 ] );
+        CHECK( "fast 5" == lines[ 4 ] );
+    }
+} //TestInterleaved
+
+static void TestLongLine()
+{
+    // a line too big for a ring record is written directly, after what was queued before it
+
+    tracer.Enable( true, LogFile, true );
+    tracer.SetQuiet( true );
+    tracer.EnableBinaryRing( true, 64 * 1024, 1000 );
+
+    string big( 5000, 'x' );
+    tracer.TraceFast<traceVerbose>( "before\n" );
+    tracer.Trace( "%s\n", big.c_str() );
+    tracer.Trace( "after\n" );
+
+    tracer.EnableBinaryRing( false );
+    tracer.Shutdown();
+
+    vector<string> lines = ReadLines();
+    CHECK( 3 == lines.size() );
+
+    if ( 3 == lines.size() )
+    {
+        CHECK( "before" == lines[ 0 ] );
+        CHECK( big == lines[ 1 ] );
+        CHECK( "after" == lines[ 2 ] );
+    }
+} //TestLongLine
+
+static void TestThreads()
+{
+    // a tiny ring and a slow flusher: TraceFast drops, Trace must not, and each thread stays in order
+
+    const int threads = 4, perThread = 2000;
+
+    tracer.Enable( true, LogFile, true );
+    tracer.SetQuiet( true );
+    tracer.EnableBinaryRing( true, 4096, 50 );
+
+    vector<thread> pool;
+
+    for ( int t = 0; t < threads; t++ )
+    {
+        pool.emplace_back( [t] ()
+        {
+            for ( int i = 0; i < perThread; i++ )
+            {
+                tracer.Trace( "T %d %d\n", t, i );
+                tracer.TraceFast<traceVerbose>( "F %d %d\n", t, i );
+            }
+        } );
+    }
+
+    for ( size_t t = 0; t < pool.size(); t++ )
+        pool[ t ].join();
+
+    tracer.EnableBinaryRing( false );
+    tracer.Shutdown();
+
+    vector<string> lines = ReadLines();
+    vector<int> lastTrace( threads, -1 ), lastFast( threads, -1 );
+    int traces = 0, fasts = 0;
+    bool ordered = true;
+
+    for ( size_t l = 0; l < lines.size(); l++ )
+    {
+        char kind = 0;
+        int t = 0, i = 0;
+
+        if ( 3 != sscanf( lines[ l ].c_str(), "%c %d %d", &kind, &t, &i ) || t < 0 || t >= threads )
+            continue;
+
+        if ( 'T' == kind )
+        {
+            ordered = ordered && ( i == lastTrace[ t ] + 1 ) && ( i > lastFast[ t ] );
+            lastTrace[ t ] = i;
+            traces++;
+        }
+        else if ( 'F' == kind )
+        {
+            ordered = ordered && ( i > lastFast[ t ] ) && ( i == lastTrace[ t ] );
+            lastFast[ t ] = i;
+            fasts++;
+        }
+    }
+
+    printf( "threads: %d Trace lines, %d of %d TraceFast lines kept\n", traces, fasts, threads * perThread );
+    CHECK( threads * perThread == traces );
+    CHECK( ordered );
+} //TestThreads
+
+static void TestShortLivedThreads()
+{
+    // one thread per decode, as photoss does: each gets a ring, which must go away after the thread does
+
+    const int threads = 200;
+
+    tracer.Enable( true, LogFile, true );
+    tracer.SetQuiet( true );
+    tracer.EnableBinaryRing( true, 64 * 1024, 5 );
+
+    tracer.Trace( "main\n" );
+    size_t most = 0;
+
+    for ( int t = 0; t < threads; t++ )
+    {
+        thread( [t] ()
+        {
+            tracer.Trace( "S %d\n", t );
+            tracer.TraceFast<traceVerbose>( "F %d\n", t );
+        } ).join();
+
+        if ( 0 == ( t % 20 ) )
+            sleep_ms( 20 ); // let the flusher run
+
+        most = get_max( most, tracer.RingCount() );
+    }
+
+    tracer.EnableBinaryRing( false ); // the last drain frees what the flusher hasn't
+    size_t remaining = tracer.RingCount();
+    tracer.Shutdown();
+
+    vector<string> lines = ReadLines();
+    int found = 0;
+
+    for ( size_t l = 0; l < lines.size(); l++ )
+        found += ( 'S' == lines[ l ][ 0 ] || 'F' == lines[ l ][ 0 ] );
+
+    printf( "short-lived threads: at most %zu rings, %zu left after the last flush\n", most, remaining );
+    CHECK( 2 * threads == found );
+    CHECK( 1 == remaining );               // just main's
+    CHECK( most < (size_t) threads / 2 );
+} //TestShortLivedThreads
+
+int main( int argc, char * argv[] )
+{
+    TestInterleaved();
+    TestLongLine();
+    TestThreads();
+    TestShortLivedThreads();
+
+    remove( LogFile );
+    printf( "tracetest: %s\n", ( 0 == g_Failures ) ? "pass" : "FAIL" );
+    return ( 0 == g_Failures ) ? 0 : 1;
+} //main